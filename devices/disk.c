@@ -3,10 +3,14 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/timer.h"
+#include "intrinsic.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -32,6 +36,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -45,8 +50,46 @@
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
-#define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
-#define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTORS with retries. */
+#define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTORS with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Bus master IDE registers, relative to a channel's bm_base.
+   See the PCI IDE Controller and Bus Master specifications. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop the transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  ERROR and INTR are cleared by
+   writing 1 to them. */
+#define BM_STA_ERROR 0x02       /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Device raised its interrupt. */
+
+/* Physical Region Descriptor: one physically contiguous piece of
+   a DMA transfer.  A piece may not cross a 64 kB boundary, and a
+   byte count of 0 means 64 kB. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Byte count. */
+	uint16_t flags;             /* PRD_EOT on the last entry. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_MAX (PGSIZE / sizeof (struct prd))
+
+/* Request latency histograms.  Bucket 0 counts latencies of 0,
+   and bucket I > 0 counts latencies in [2**(I-1), 2**I); the last
+   bucket also takes everything longer. */
+#define LAT_TICK_BUCKETS 16     /* In timer ticks. */
+#define LAT_TSC_BUCKETS 48      /* In time-stamp counter cycles. */
 
 /* An ATA device. */
 struct disk {
@@ -59,6 +102,19 @@ struct disk {
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+	long long cmd_cnt;          /* Number of read and write commands. */
+	long long dma_cnt;          /* Number of those that used DMA. */
+	long long merge_cnt;        /* Requests merged into a queued one. */
+
+	disk_sector_t head_pos;     /* Sector after the last one requested. */
+	long long seek_dist;        /* Total sectors the head moved. */
+
+	long long request_cnt;      /* Requests completed, merged or not. */
+	int queue_depth;            /* Requests submitted but not completed. */
+	int max_queue_depth;        /* Highest QUEUE_DEPTH seen. */
+	long long queue_depth_sum;  /* QUEUE_DEPTH seen by each submission. */
+	long long tick_hist[LAT_TICK_BUCKETS];  /* Latency in ticks. */
+	long long tsc_hist[LAT_TSC_BUCKETS];    /* Latency in TSC cycles. */
 };
 
 /* An ATA channel (aka controller).
@@ -68,11 +124,22 @@ struct channel {
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	/* Request queue.  Protected by disabling interrupts, since the
+	   interrupt handler starts each request as the last finishes. */
+	struct list queue;          /* Pending struct disk_requests. */
+	struct disk_request *active;    /* Request in progress, or NULL. */
+	bool active_dma;            /* True if ACTIVE is moving by DMA. */
+	size_t sectors_left;        /* Sectors of ACTIVE not yet moved. */
+	struct disk_request *cur;   /* Request holding the next PIO sector. */
+	size_t cur_done;            /* Sectors of CUR already moved. */
+
+	uint16_t bm_base;           /* Bus master registers, 0 if no DMA. */
+	struct prd *prdt;           /* PRD table, one page. */
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
@@ -84,23 +151,49 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void transfer (struct disk *, disk_sector_t, size_t cnt,
+		uint8_t *, bool write);
+static void start_request (struct channel *);
+static void continue_request (struct channel *);
+static void finish_request (struct channel *);
+static void request_failed (struct channel *) NO_RETURN;
+static void record_latency (struct disk_request *, int64_t tick,
+		uint64_t tsc);
+static int hist_bucket (uint64_t value, int cnt);
+static uint8_t *next_sector_buffer (struct channel *);
+
+static uint16_t find_bus_master (void);
+static bool dma_usable (struct channel *, struct disk_request *);
+static void build_prdt (struct channel *, struct disk_request *);
+
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
 static void select_device (const struct disk *);
 static void select_device_wait (const struct disk *);
+static bool poll_drq (struct channel *);
 
 static void interrupt_handler (struct intr_frame *);
+static void print_histogram (const struct disk *, const char *title,
+		const long long hist[], int cnt);
+
+/* -dma: Move sector data by PCI bus-master DMA rather than PIO,
+   if an IDE controller that supports it is found. */
+bool disk_use_dma;
 
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = disk_use_dma ? find_bus_master () : 0;
 	size_t chan_no;
 
+	if (disk_use_dma && bm_base == 0)
+		printf ("disk: no bus master IDE controller, using PIO\n");
+
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
 		struct channel *c = &channels[chan_no];
 		int dev_no;
@@ -119,9 +212,19 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		list_init (&c->queue);
+		c->active = NULL;
+
+		/* Each channel has its own set of bus master registers. */
+		c->bm_base = 0;
+		c->prdt = NULL;
+		if (bm_base != 0) {
+			c->prdt = palloc_get_page (0);
+			if (c->prdt != NULL)
+				c->bm_base = bm_base + 8 * chan_no;
+		}
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -134,6 +237,15 @@ disk_init (void) {
 			d->capacity = 0;
 
 			d->read_cnt = d->write_cnt = 0;
+			d->cmd_cnt = d->dma_cnt = d->merge_cnt = 0;
+			d->head_pos = 0;
+			d->seek_dist = 0;
+
+			d->request_cnt = 0;
+			d->queue_depth = d->max_queue_depth = 0;
+			d->queue_depth_sum = 0;
+			memset (d->tick_hist, 0, sizeof d->tick_hist);
+			memset (d->tsc_hist, 0, sizeof d->tsc_hist);
 		}
 
 		/* Register interrupt handler. */
@@ -166,13 +278,49 @@ disk_print_stats (void) {
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+			long long depth_x100;
+
+			if (d == NULL || !d->is_ata)
+				continue;
+
+			printf ("%s: %lld reads, %lld writes, %lld commands (%lld DMA), "
+					"%lld merged, %lld sectors seeked\n",
+					d->name, d->read_cnt, d->write_cnt, d->cmd_cnt, d->dma_cnt,
+					d->merge_cnt, d->seek_dist);
+			if (d->request_cnt == 0)
+				continue;
+
+			depth_x100 = d->queue_depth_sum * 100 / d->request_cnt;
+			printf ("%s: %lld requests, queue depth %lld.%02lld avg, %d max, "
+					"%lld kB moved\n", d->name, d->request_cnt,
+					depth_x100 / 100, depth_x100 % 100, d->max_queue_depth,
+					(d->read_cnt + d->write_cnt) * DISK_SECTOR_SIZE / 1024);
+			print_histogram (d, "latency ticks", d->tick_hist, LAT_TICK_BUCKETS);
+			print_histogram (d, "latency cycles", d->tsc_hist, LAT_TSC_BUCKETS);
 		}
 	}
 }
 
+/* Prints the nonempty buckets of histogram HIST, which has CNT
+   buckets, on one line labeled with D's name and TITLE.  Each
+   bucket is shown as "LOW:COUNT", where LOW is the smallest
+   value it counts, as a power of 2. */
+static void
+print_histogram (const struct disk *d, const char *title,
+		const long long hist[], int cnt) {
+	int i;
+
+	printf ("%s: %s:", d->name, title);
+	for (i = 0; i < cnt; i++)
+		if (hist[i] != 0) {
+			if (i == 0)
+				printf (" 0:%lld", hist[i]);
+			else
+				printf (" 2^%d:%lld", i - 1, hist[i]);
+		}
+	printf ("\n");
+}
+
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
    slave, respectively--within the channel numbered CHAN_NO.
 
@@ -209,21 +357,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multi (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +367,437 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	disk_write_multi (d, sec_no, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  Up to DISK_MULTI_MAX sectors move per request, by DMA
+   if it is enabled and otherwise by PIO.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multi (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	transfer (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Up to DISK_MULTI_MAX sectors move per request, by DMA if it is
+   enabled and otherwise by PIO.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multi (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	transfer (d, sec_no, cnt, (uint8_t *) buffer, true);
+}
+
+/* Moves CNT sectors between disk D, starting at SEC_NO, and
+   BUFFER, one request of up to DISK_MULTI_MAX sectors at a time,
+   and waits for each to complete. */
+static void
+transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		uint8_t *buffer, bool write) {
+	ASSERT (d != NULL);
+	ASSERT (buffer != NULL);
+
+	while (cnt > 0) {
+		struct disk_request r;
+		size_t n = cnt < DISK_MULTI_MAX ? cnt : DISK_MULTI_MAX;
+
+		disk_submit (&r, d, sec_no, n, buffer, write);
+		disk_wait (&r);
+		buffer += n * DISK_SECTOR_SIZE;
+		sec_no += n;
+		cnt -= n;
+	}
+}
+
+/* Asynchronous requests. */
+
+/* Queues request R to move CNT sectors, at most DISK_MULTI_MAX,
+   between disk D, starting at SEC_NO, and BUFFER: to the disk if
+   WRITE is true, from it otherwise.  Returns without waiting;
+   call disk_wait() on R before touching R or BUFFER again.
+
+   If a queued request of the same kind ends just before SEC_NO,
+   R is merged into it so that one command moves both.  Each
+   channel serves its queue in C-LOOK order; see
+   start_request(). */
+void
+disk_submit (struct disk_request *r, struct disk *d, disk_sector_t sec_no,
+		size_t cnt, void *buffer, bool write) {
 	struct channel *c;
+	enum intr_level old_level;
+	struct list_elem *e;
 
+	ASSERT (r != NULL);
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MULTI_MAX);
+	ASSERT (sec_no + cnt <= d->capacity);
+
+	r->disk = d;
+	r->sector = sec_no;
+	r->cnt = cnt;
+	r->buffer = buffer;
+	r->write = write;
+	sema_init (&r->done, 0);
+	list_init (&r->merged);
+	r->total_cnt = cnt;
+	r->submit_tick = timer_ticks ();
+	r->submit_tsc = rdtsc ();
 
 	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
-	lock_release (&c->lock);
+	old_level = intr_disable ();
+	d->queue_depth++;
+	if (d->queue_depth > d->max_queue_depth)
+		d->max_queue_depth = d->queue_depth;
+	d->queue_depth_sum += d->queue_depth;
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+
+		if (q->disk == d && q->write == write
+				&& q->sector + q->total_cnt == sec_no
+				&& q->total_cnt + cnt <= DISK_MULTI_MAX) {
+			list_push_back (&q->merged, &r->elem);
+			q->total_cnt += cnt;
+			d->merge_cnt++;
+			intr_set_level (old_level);
+			return;
+		}
+	}
+	list_push_back (&c->queue, &r->elem);
+	if (c->active == NULL)
+		start_request (c);
+	intr_set_level (old_level);
 }
-
+
+/* Waits for request R, submitted with disk_submit(), to
+   complete. */
+void
+disk_wait (struct disk_request *r) {
+	sema_down (&r->done);
+}
+
+/* Starts the next request queued on channel C, which must be
+   idle.  Requests are served in C-LOOK order: the one nearest at
+   or after its disk's head position, or, once none lies ahead,
+   the lowest-numbered one, so the head sweeps upward and then
+   jumps back.  Must be called with interrupts off. */
+static void
+start_request (struct channel *c) {
+	struct disk_request *r = NULL;
+	uint64_t best = UINT64_MAX;
+	struct disk *d;
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (c->active == NULL);
+	ASSERT (!list_empty (&c->queue));
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+		disk_sector_t head = q->disk->head_pos;
+		uint64_t dist = q->sector >= head ? q->sector - head
+			: (1ULL << 32) + q->sector;
+
+		if (dist < best) {
+			r = q;
+			best = dist;
+		}
+	}
+	list_remove (&r->elem);
+
+	d = r->disk;
+	d->seek_dist += r->sector >= d->head_pos ? r->sector - d->head_pos
+		: d->head_pos - r->sector;
+	d->head_pos = r->sector + r->total_cnt;
+	d->cmd_cnt++;
+
+	c->active = r;
+	c->active_dma = dma_usable (c, r);
+	c->sectors_left = r->total_cnt;
+	c->cur = r;
+	c->cur_done = 0;
+
+	if (c->active_dma) {
+		uint8_t direction = r->write ? 0 : BM_CMD_READ;
+
+		build_prdt (c, r);
+		outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+		outb (c->bm_base + BM_COMMAND, direction);
+		outb (c->bm_base + BM_STATUS,
+				inb (c->bm_base + BM_STATUS) | BM_STA_ERROR | BM_STA_INTR);
+
+		select_sector (d, r->sector, r->total_cnt);
+		issue_pio_command (c, r->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+		outb (c->bm_base + BM_COMMAND, direction | BM_CMD_START);
+		d->dma_cnt++;
+	} else {
+		select_sector (d, r->sector, r->total_cnt);
+		issue_pio_command (c, r->write
+				? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+
+		/* A write waits for the first sector before it
+		   interrupts; later ones are sent from
+		   continue_request(). */
+		if (r->write) {
+			if (!poll_drq (c))
+				request_failed (c);
+			output_sector (c, next_sector_buffer (c));
+			c->sectors_left--;
+		}
+	}
+}
+
+/* Advances channel C's active request in response to a disk
+   interrupt.  By PIO, the disk interrupts once per sector: when
+   a sector is ready to read, or after it has taken a written
+   one.  By DMA, it interrupts once, at the end. */
+static void
+continue_request (struct channel *c) {
+	struct disk_request *r = c->active;
+	uint8_t status = inb (reg_status (c));       /* Acknowledge interrupt. */
+
+	if (status & STA_ERR)
+		request_failed (c);
+
+	if (c->active_dma) {
+		uint8_t bm_status = inb (c->bm_base + BM_STATUS);
+
+		outb (c->bm_base + BM_COMMAND, 0);
+		outb (c->bm_base + BM_STATUS, bm_status | BM_STA_ERROR | BM_STA_INTR);
+		if (bm_status & BM_STA_ERROR)
+			request_failed (c);
+		c->sectors_left = 0;
+		finish_request (c);
+	} else if (!r->write) {
+		if (!poll_drq (c))
+			request_failed (c);
+		input_sector (c, next_sector_buffer (c));
+		if (--c->sectors_left == 0)
+			finish_request (c);
+	} else if (c->sectors_left == 0)
+		finish_request (c);
+	else {
+		if (!poll_drq (c))
+			request_failed (c);
+		output_sector (c, next_sector_buffer (c));
+		c->sectors_left--;
+	}
+}
+
+/* Completes channel C's active request and every request merged
+   into it, waking their waiters, and starts the next queued
+   request, if any. */
+static void
+finish_request (struct channel *c) {
+	struct disk_request *r = c->active;
+	struct disk *d = r->disk;
+	int64_t tick = timer_ticks ();
+	uint64_t tsc = rdtsc ();
+
+	if (r->write)
+		d->write_cnt += r->total_cnt;
+	else
+		d->read_cnt += r->total_cnt;
+
+	c->active = NULL;
+	c->expecting_interrupt = false;
+	while (!list_empty (&r->merged)) {
+		struct list_elem *e = list_pop_front (&r->merged);
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+
+		record_latency (q, tick, tsc);
+		sema_up (&q->done);
+	}
+	record_latency (r, tick, tsc);
+	sema_up (&r->done);
+
+	if (!list_empty (&c->queue))
+		start_request (c);
+}
+
+/* Adds request R, completed at timer tick TICK and time-stamp
+   counter TSC, to its disk's statistics. */
+static void
+record_latency (struct disk_request *r, int64_t tick, uint64_t tsc) {
+	struct disk *d = r->disk;
+
+	d->tick_hist[hist_bucket (tick - r->submit_tick, LAT_TICK_BUCKETS)]++;
+	d->tsc_hist[hist_bucket (tsc - r->submit_tsc, LAT_TSC_BUCKETS)]++;
+	d->request_cnt++;
+	d->queue_depth--;
+}
+
+/* Returns the bucket of a CNT-bucket latency histogram that
+   counts latency VALUE. */
+static int
+hist_bucket (uint64_t value, int cnt) {
+	int bucket = 0;
+
+	while (value != 0 && bucket < cnt - 1) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/* Panics on a failed transfer in channel C's active request. */
+static void
+request_failed (struct channel *c) {
+	struct disk_request *r = c->active;
+
+	PANIC ("%s: disk %s failed, sector=%"PRDSNu, r->disk->name,
+			r->write ? "write" : "read",
+			(disk_sector_t) (r->sector + r->total_cnt - c->sectors_left));
+}
+
+/* Returns where the next sector of channel C's active request
+   moves to or from by PIO, stepping from one merged request's
+   buffer to the next. */
+static uint8_t *
+next_sector_buffer (struct channel *c) {
+	struct disk_request *r = c->cur;
+
+	if (c->cur_done == r->cnt) {
+		struct list_elem *e = r == c->active
+			? list_begin (&r->merged) : list_next (&r->elem);
+
+		ASSERT (e != list_end (&c->active->merged));
+		r = c->cur = list_entry (e, struct disk_request, elem);
+		c->cur_done = 0;
+	}
+	return r->buffer + c->cur_done++ * DISK_SECTOR_SIZE;
+}
+
+/* Bus-master DMA. */
+
+/* Reads the 32-bit PCI configuration register REG of function
+   FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register REG of
+   function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can act as a bus
+   master, such as the PIIX3 that QEMU emulates.  Enables bus
+   mastering and returns the I/O port of its bus master
+   registers, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (dev, func, 0x00);
+			uint32_t class = pci_read_config (dev, func, 0x08);
+			uint32_t bar4;
+
+			if ((id & 0xffff) == 0xffff)
+				continue;
+
+			/* Class 01h (mass storage), subclass 01h (IDE), with
+			   programming interface bit 7 set (bus master). */
+			if ((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+
+			/* BAR4 must be an I/O space address. */
+			bar4 = pci_read_config (dev, func, 0x20);
+			if (!(bar4 & 1) || (bar4 & ~3u) == 0)
+				continue;
+
+			/* Set the I/O space and bus master enable bits. */
+			pci_write_config (dev, func, 0x04,
+					pci_read_config (dev, func, 0x04) | 0x5);
+			printf ("disk: bus master IDE at port %#x\n", bar4 & ~3u);
+			return bar4 & ~3u;
+		}
+	return 0;
+}
+
+/* Returns true if the CNT sectors at BUFFER can take part in a
+   DMA transfer: BUFFER must lie entirely below 4 GB physical,
+   since PRD addresses are 32 bits. */
+static bool
+dma_buffer_usable (const void *buffer, size_t cnt) {
+	return is_kernel_vaddr (buffer)
+		&& vtop (buffer) + cnt * DISK_SECTOR_SIZE <= 0x100000000ULL;
+}
+
+/* Returns true if request R, with every request merged into it,
+   can move by DMA on channel C. */
+static bool
+dma_usable (struct channel *c, struct disk_request *r) {
+	struct list_elem *e;
+
+	if (c->bm_base == 0 || !dma_buffer_usable (r->buffer, r->cnt))
+		return false;
+	for (e = list_begin (&r->merged); e != list_end (&r->merged);
+			e = list_next (e)) {
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+		if (!dma_buffer_usable (q->buffer, q->cnt))
+			return false;
+	}
+	return true;
+}
+
+/* Appends entries to channel C's PRD table, starting at index I,
+   to describe the SIZE bytes at BUFFER, and returns the index
+   after the last one.  All of physical memory is mapped
+   contiguously at KERN_BASE, so BUFFER only has to be split at
+   64 kB boundaries. */
+static size_t
+add_prds (struct channel *c, size_t i, void *buffer, size_t size) {
+	uint64_t addr = vtop (buffer);
+
+	while (size > 0) {
+		size_t chunk = 0x10000 - (addr & 0xffff);
+		if (chunk > size)
+			chunk = size;
+
+		ASSERT (i < PRD_MAX);
+		c->prdt[i].addr = addr;
+		c->prdt[i].size = chunk & 0xffff;
+		c->prdt[i].flags = 0;
+		addr += chunk;
+		size -= chunk;
+		i++;
+	}
+	return i;
+}
+
+/* Fills channel C's PRD table to describe the buffers of request
+   R and of the requests merged into it, in sector order. */
+static void
+build_prdt (struct channel *c, struct disk_request *r) {
+	struct list_elem *e;
+	size_t i;
+
+	i = add_prds (c, 0, r->buffer, r->cnt * DISK_SECTOR_SIZE);
+	for (e = list_begin (&r->merged); e != list_end (&r->merged);
+			e = list_next (e)) {
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+		i = add_prds (c, i, q->buffer, q->cnt * DISK_SECTOR_SIZE);
+	}
+	c->prdt[i - 1].flags = PRD_EOT;
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -352,6 +900,7 @@ identify_ata_device (struct disk *d) {
 	/* Send the IDENTIFY DEVICE command, wait for an interrupt
 	   indicating the device's response is ready, and read the data
 	   into our buffer. */
+	ASSERT (intr_get_level () == INTR_ON);
 	select_device_wait (d);
 	issue_pio_command (c, CMD_IDENTIFY_DEVICE);
 	sema_down (&c->completion_wait);
@@ -402,17 +951,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.)  A count of
+   DISK_MULTI_MAX is written as 0, as ATA requires. */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= DISK_MULTI_MAX);
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == DISK_MULTI_MAX ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -424,10 +975,6 @@ select_sector (struct disk *d, disk_sector_t sec_no) {
    completion interrupt. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) {
-	/* Interrupts must be enabled or our semaphore will never be
-	   up'd by the completion handler. */
-	ASSERT (intr_get_level () == INTR_ON);
-
 	c->expecting_interrupt = true;
 	outb (reg_command (c), command);
 }
@@ -460,7 +1007,7 @@ wait_until_idle (const struct disk *d) {
 	for (i = 0; i < 1000; i++) {
 		if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
 			return;
-		timer_usleep (10);
+		timer_udelay (10);
 	}
 
 	printf ("%s: idle timeout\n", d->name);
@@ -499,7 +1046,7 @@ select_device (const struct disk *d) {
 		dev |= DEV_DEV;
 	outb (reg_device (c), dev);
 	inb (reg_alt_status (c));
-	timer_nsleep (400);
+	timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -510,6 +1057,23 @@ select_device_wait (const struct disk *d) {
 	select_device (d);
 	wait_until_idle (d);
 }
+
+/* Waits up to about a second, without sleeping, for channel C's
+   selected disk to clear BSY, and then returns true if it is
+   ready to move data: DRQ is set and ERR is clear.  Unlike
+   wait_while_busy(), may be called from the interrupt handler. */
+static bool
+poll_drq (struct channel *c) {
+	int i;
+
+	for (i = 0; i < 100000; i++) {
+		uint8_t status = inb (reg_alt_status (c));
+		if (!(status & STA_BSY))
+			return (status & (STA_DRQ | STA_ERR)) == STA_DRQ;
+		timer_udelay (10);
+	}
+	return false;
+}
 
 /* ATA interrupt handler. */
 static void
@@ -518,7 +1082,9 @@ interrupt_handler (struct intr_frame *f) {
 
 	for (c = channels; c < channels + CHANNEL_CNT; c++)
 		if (f->vec_no == c->irq) {
-			if (c->expecting_interrupt) {
+			if (c->active != NULL)
+				continue_request (c);
+			else if (c->expecting_interrupt) {
 				inb (reg_status (c));               /* Acknowledge interrupt. */
 				sema_up (&c->completion_wait);      /* Wake up waiter. */
 			} else
@@ -541,14 +1107,75 @@ inspect_write_cnt (struct intr_frame *f) {
 	f->R.rax = d->write_cnt;
 }
 
+/* Returns the disk named by F's RDX and RCX for an inspect
+   handler, or a null pointer if there is no such disk. */
+static struct disk *
+inspect_disk (struct intr_frame *f) {
+	if (f->R.rdx >= CHANNEL_CNT || f->R.rcx > 1)
+		return NULL;
+	return disk_get (f->R.rdx, f->R.rcx);
+}
+
+static void
+inspect_latency (struct intr_frame *f) {
+	struct disk *d = inspect_disk (f);
+	uint64_t bucket = f->R.rdi;
+
+	if (d == NULL)
+		f->R.rax = -1;
+	else if (f->R.rsi == 0 && bucket < LAT_TICK_BUCKETS)
+		f->R.rax = d->tick_hist[bucket];
+	else if (f->R.rsi == 1 && bucket < LAT_TSC_BUCKETS)
+		f->R.rax = d->tsc_hist[bucket];
+	else
+		f->R.rax = -1;
+}
+
+static void
+inspect_queue (struct intr_frame *f) {
+	struct disk *d = inspect_disk (f);
+
+	if (d == NULL)
+		f->R.rax = -1;
+	else
+		switch (f->R.rsi) {
+			case 0: f->R.rax = d->request_cnt; break;
+			case 1: f->R.rax = d->queue_depth_sum; break;
+			case 2: f->R.rax = d->max_queue_depth; break;
+			case 3: f->R.rax = d->read_cnt * DISK_SECTOR_SIZE; break;
+			case 4: f->R.rax = d->write_cnt * DISK_SECTOR_SIZE; break;
+			default: f->R.rax = -1; break;
+		}
+}
+
 /* Tool for testing disk r/w cnt. Calling this function via int 0x43 and int 0x44.
  * Input:
  *   @RDX - chan_no of disk to inspect
  *   @RCX - dev_no of disk to inspect
  * Output:
- *   @RAX - Read/Write count of disk. */
+ *   @RAX - Read/Write count of disk.
+ *
+ * int 0x45 reads one bucket of a request latency histogram.
+ * Input:
+ *   @RDX, @RCX - as above
+ *   @RSI - 0 for the histogram in timer ticks, 1 for TSC cycles
+ *   @RDI - bucket: 0 counts latencies of 0, I > 0 counts latencies
+ *          in [2**(I-1), 2**I); there are 16 and 48 buckets
+ * Output:
+ *   @RAX - Requests in the bucket, or -1 on bad input.
+ *
+ * int 0x46 reads a request queue statistic.
+ * Input:
+ *   @RDX, @RCX - as above
+ *   @RSI - 0 requests completed, 1 sum of the queue depths seen by
+ *          each request (divide by requests for the average),
+ *          2 maximum queue depth, 3 bytes read, 4 bytes written
+ * Output:
+ *   @RAX - The statistic, or -1 on bad input. */
 void
 register_disk_inspect_intr (void) {
 	intr_register_int (0x43, 3, INTR_OFF, inspect_read_cnt, "Inspect Disk Read Count");
 	intr_register_int (0x44, 3, INTR_OFF, inspect_write_cnt, "Inspect Disk Write Count");
+	intr_register_int (0x45, 3, INTR_OFF, inspect_latency, "Inspect Disk Latency");
+	intr_register_int (0x46, 3, INTR_OFF, inspect_queue, "Inspect Disk Queue");
 }
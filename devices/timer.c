@@ -7,6 +7,7 @@
 #include "threads/io.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -17,31 +18,67 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency, and the count for one timer tick:
+   the frequency divided by TIMER_FREQ, rounded to nearest. */
+#define PIT_HZ 1193180
+#define PIT_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks a single one-shot count can span: the first,
+   partial one plus as many whole ones as fit in 16 bits. */
+#define IDLE_MAX_TICKS (1 + (0xffff - PIT_TICK) / PIT_TICK)
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* -tickless: While only the idle thread can run, program the
+   8254 to interrupt once, on the next tick that has work to do,
+   rather than on every tick. */
+bool timer_tickless;
+
+/* What the 8254 is programmed to do. */
+static enum {
+	TICK_PERIODIC,      /* Interrupt on every tick. */
+	TICK_IDLE,          /* Interrupt once, idle_tick_cnt ticks on. */
+	TICK_RESUME         /* Interrupt once, on the next tick, then
+	                       go back to periodic. */
+} tick_mode;
+
+/* In TICK_IDLE mode, the number of ticks the one-shot count
+   spans, the counts to the first of them, and the counts in
+   all. */
+static int64_t idle_tick_cnt;
+static uint16_t idle_first_count;
+static uint16_t idle_count;
+
+/* Number of ticks that passed without a timer interrupt. */
+static long long skipped_ticks;
+
+/* Time-stamp counter cycles spent in timer_interrupt(), which
+   runs with interrupts off: the most in any one tick, and the
+   total over all ticks. */
+static uint64_t intr_max_cycles;
+static uint64_t intr_total_cycles;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void run_ticks (int64_t cnt);
+static void pit_periodic (void);
+static void pit_oneshot (uint16_t count);
+static uint16_t pit_read (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void real_time_delay (int64_t num, int32_t denom);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
-
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
-
+	pit_periodic ();
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -119,17 +156,165 @@ timer_nsleep (int64_t ns) {
 	real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Busy-waits for approximately US microseconds.  Unlike
+   timer_usleep(), this never yields, so it may be called with
+   interrupts disabled or from an interrupt handler. */
+void
+timer_udelay (int64_t us) {
+	real_time_delay (us, 1000 * 1000);
+}
+
+/* Busy-waits for approximately NS nanoseconds.  May be called
+   with interrupts disabled or from an interrupt handler. */
+void
+timer_ndelay (int64_t ns) {
+	real_time_delay (ns, 1000 * 1000 * 1000);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
-	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	int64_t t = timer_ticks ();
+
+	printf ("Timer: %"PRId64" ticks\n", t);
+	printf ("Timer: interrupt handler ran at most %"PRIu64" cycles, "
+			"%"PRIu64" on average\n",
+			intr_max_cycles, t > 0 ? intr_total_cycles / t : 0);
+	if (timer_tickless)
+		printf ("Timer: %lld ticks skipped while idle\n", skipped_ticks);
 }
 
+/* Tickless idle. */
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  With -tickless, if no sleeping thread is due on the
+   next tick, replaces the periodic interrupt by a single one on
+   the tick when one is, or IDLE_MAX_TICKS ticks on, whichever
+   comes first.  The ticks in between are made up for when that
+   interrupt arrives, or by timer_idle_exit() if some other
+   interrupt arrives first. */
+void
+timer_idle_enter (void) {
+	uint16_t left;
+	int64_t cnt;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!timer_tickless || tick_mode != TICK_PERIODIC)
+		return;
+	cnt = thread_next_wakeup (ticks + IDLE_MAX_TICKS) - ticks;
+	if (cnt < 2)
+		return;
+
+	/* Keep the current tick's phase: the one-shot runs out what
+	   is left of this tick plus CNT - 1 whole ones.  Don't race a
+	   tick that is about to end, or one that has ended but whose
+	   interrupt is still pending. */
+	left = pit_read ();
+	if (left < PIT_TICK / 8 || intr_pending (0x20))
+		return;
+
+	idle_tick_cnt = cnt;
+	idle_first_count = left;
+	idle_count = left + (cnt - 1) * PIT_TICK;
+	pit_oneshot (idle_count);
+	tick_mode = TICK_IDLE;
+}
+
+/* Ends a tickless idle period early, because an interrupt other
+   than the timer's has arrived and may ready a thread.  Runs the
+   work of every tick that has passed since the period began, so
+   that ticks and the scheduler's per-tick and per-second
+   accounting are as if the timer had never stopped, and then
+   arranges an interrupt at the end of the current tick, after
+   which the timer goes back to periodic.  Called by
+   intr_handler() with interrupts off. */
+void
+timer_idle_exit (void) {
+	uint16_t elapsed;
+	int64_t cnt;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (tick_mode != TICK_IDLE)
+		return;
+
+	/* Read the counter before checking for a pending interrupt:
+	   if the one-shot runs out in between, ELAPSED still falls
+	   short of its end, and that interrupt counts as the one at
+	   the end of the current tick. */
+	elapsed = idle_count - pit_read ();
+	if (intr_pending (0x20))
+		return;
+
+	cnt = elapsed < idle_first_count ? 0
+		: 1 + (elapsed - idle_first_count) / PIT_TICK;
+	ASSERT (cnt < idle_tick_cnt);
+
+	tick_mode = TICK_RESUME;
+	pit_oneshot (idle_first_count + cnt * PIT_TICK - elapsed);
+	skipped_ticks += cnt;
+	run_ticks (cnt);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
-	thread_wakeup(++ticks);
-	thread_tick ();
+	uint64_t start = rdtsc ();
+	uint64_t cycles;
+	int64_t cnt = 1;
+
+	if (tick_mode != TICK_PERIODIC) {
+		if (tick_mode == TICK_IDLE) {
+			cnt = idle_tick_cnt;
+			skipped_ticks += cnt - 1;
+		}
+		tick_mode = TICK_PERIODIC;
+		pit_periodic ();
+	}
+	run_ticks (cnt);
+
+	cycles = rdtsc () - start;
+	intr_total_cycles += cycles;
+	if (cycles > intr_max_cycles)
+		intr_max_cycles = cycles;
+}
+
+/* Does the work of CNT timer ticks, one after another. */
+static void
+run_ticks (int64_t cnt) {
+	while (cnt-- > 0) {
+		thread_wakeup(++ticks);
+		thread_tick ();
+	}
+}
+
+/* Programs 8254 counter 0 to interrupt once per tick. */
+static void
+pit_periodic (void) {
+	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, PIT_TICK & 0xff);
+	outb (0x40, PIT_TICK >> 8);
+}
+
+/* Programs 8254 counter 0 to interrupt once, COUNT input clocks
+   from now. */
+static void
+pit_oneshot (uint16_t count) {
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Returns the current value of 8254 counter 0. */
+static uint16_t
+pit_read (void) {
+	uint8_t lo, hi;
+
+	outb (0x43, 0x00);    /* CW: counter 0, latch count. */
+	lo = inb (0x40);
+	hi = inb (0x40);
+	return lo | (hi << 8);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -188,3 +373,12 @@ real_time_sleep (int64_t num, int32_t denom) {
 		busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
 	}
 }
+
+/* Busy-wait for approximately NUM/DENOM seconds. */
+static void
+real_time_delay (int64_t num, int32_t denom) {
+	/* Scale the numerator and denominator down by 1000 to avoid
+	   the possibility of overflow. */
+	ASSERT (denom % 1000 == 0);
+	busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+}
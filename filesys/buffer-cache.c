@@ -0,0 +1,495 @@
+#include "filesys/buffer-cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/fat.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Sector cache that sits between the inode layer and the file
+ * system disk.  Lookups go through a hash keyed by sector
+ * number, replacement uses the clock algorithm, and dirty
+ * sectors are written back only when they are evicted or when
+ * the cache is flushed.
+ *
+ * Sectors are read from disk, and dirty victims written back,
+ * without holding cache_lock.  The entry is marked BUSY
+ * meanwhile, so that other lookups wait on io_done and the clock
+ * skips it.  A read-ahead daemon uses the
+ * same path to fill entries in the background, and a flusher
+ * daemon writes back sectors that have stayed dirty too long.
+ * Runs of consecutive sectors are read and written with one
+ * multi-sector disk command, through a bounce buffer. */
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;      /* Element in cache_map, if valid. */
+	disk_sector_t sector;       /* Sector number. */
+	bool valid;                 /* True if DATA holds SECTOR. */
+	bool dirty;                 /* True if DATA is newer than the disk. */
+	bool accessed;              /* Second chance bit for the clock. */
+	bool busy;                  /* True while DATA is being read or written. */
+	int64_t dirty_since;        /* Timer tick at which DIRTY was set. */
+	uint8_t data[DISK_SECTOR_SIZE];
+};
+
+static struct cache_entry cache[BUFFER_CACHE_SIZE];
+static struct hash cache_map;   /* Valid entries, keyed by sector. */
+static size_t clock_hand;       /* Next entry the clock looks at. */
+static struct lock cache_lock;  /* Protects everything above. */
+static struct condition io_done; /* Signaled when an entry stops being busy. */
+
+static long long hit_cnt;       /* Lookups served from the cache. */
+static long long miss_cnt;      /* Lookups that had to fill an entry. */
+static long long readahead_cnt; /* Sectors filled by the read-ahead daemon. */
+static long long flush_cnt;     /* Sectors written back by the flusher. */
+
+/* -wb: Interval between flusher passes, in milliseconds.  A pass
+ * writes back every sector that has been dirty for at least one
+ * interval, so a write reaches the disk within two intervals. */
+unsigned buffer_cache_flush_ms = 1000;
+
+/* Sectors waiting to be read ahead, as a ring buffer.
+ * Requests are dropped when the queue is full. */
+#define READAHEAD_QUEUE_SIZE 32
+static disk_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;   /* Next request to serve. */
+static size_t readahead_queued; /* Number of queued requests. */
+static struct semaphore readahead_sema; /* Up'd once per queued request. */
+
+/* Most sectors moved by one disk command. */
+#define RUN_MAX 16
+
+/* Most dirty entries the flusher takes in one pass. */
+#define FLUSH_BATCH_MAX (BUFFER_CACHE_SIZE / 2)
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static struct cache_entry *lookup (disk_sector_t);
+static struct cache_entry *get_entry (disk_sector_t, bool read_in);
+static struct cache_entry *claim_entry (disk_sector_t, bool busy, bool wait);
+static size_t fill_run (disk_sector_t, size_t cnt, bool accessed);
+static void write_back (struct cache_entry *);
+static thread_func readahead_daemon NO_RETURN;
+static thread_func flush_daemon NO_RETURN;
+static void flush_old (int64_t cutoff);
+
+/* Initializes the buffer cache. */
+void
+buffer_cache_init (void) {
+	size_t i;
+
+	hash_init (&cache_map, cache_hash, cache_less, NULL);
+	lock_init (&cache_lock);
+	cond_init (&io_done);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++)
+		cache[i].valid = false;
+	clock_hand = 0;
+
+	sema_init (&readahead_sema, 0);
+	thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+	thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+ * DISK_SECTOR_SIZE bytes. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer) {
+	buffer_cache_read_at (sector, buffer, DISK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET of sector SECTOR
+ * into BUFFER. */
+void
+buffer_cache_read_at (disk_sector_t sector, void *buffer, int size,
+		int offset) {
+	struct cache_entry *e;
+
+	ASSERT (offset >= 0 && size >= 0 && offset + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = get_entry (sector, true);
+	memcpy (buffer, e->data + offset, size);
+	lock_release (&cache_lock);
+}
+
+/* Writes DISK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer) {
+	buffer_cache_write_at (sector, buffer, DISK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER at byte OFFSET of sector SECTOR.
+ * The sector reaches the disk when it is evicted or flushed. */
+void
+buffer_cache_write_at (disk_sector_t sector, const void *buffer, int size,
+		int offset) {
+	struct cache_entry *e;
+
+	ASSERT (offset >= 0 && size >= 0 && offset + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	/* A write that covers the whole sector need not read it first. */
+	e = get_entry (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + offset, buffer, size);
+	if (!e->dirty) {
+		e->dirty = true;
+		e->dirty_since = timer_ticks ();
+	}
+	lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache.
+ * Returns immediately; the request is dropped if the daemon is
+ * too far behind. */
+void
+buffer_cache_readahead (disk_sector_t sector) {
+	bool queued = false;
+
+	lock_acquire (&cache_lock);
+	if (readahead_queued < READAHEAD_QUEUE_SIZE && lookup (sector) == NULL) {
+		size_t tail = (readahead_head + readahead_queued)
+			% READAHEAD_QUEUE_SIZE;
+		readahead_queue[tail] = sector;
+		readahead_queued++;
+		queued = true;
+	}
+	lock_release (&cache_lock);
+
+	if (queued)
+		sema_up (&readahead_sema);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache, and
+ * returns once they are there.  Each run of them that is not
+ * cached yet is read with a single disk command. */
+void
+buffer_cache_prefetch (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&cache_lock);
+	miss_cnt += fill_run (sector, cnt, true);
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+buffer_cache_flush (void) {
+	size_t i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		/* Let an in-flight flusher write finish first. */
+		while (cache[i].busy)
+			cond_wait (&io_done, &cache_lock);
+		if (cache[i].valid)
+			write_back (&cache[i]);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld read ahead, "
+			"%lld written behind\n", hit_cnt, miss_cnt, readahead_cnt, flush_cnt);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if it
+ * is not cached. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find (&cache_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Returns the entry for SECTOR, filling a free or evicted entry
+ * on a miss.  The sector is read from disk only if READ_IN is
+ * true; otherwise the caller is about to overwrite all of it.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+get_entry (disk_sector_t sector, bool read_in) {
+	struct cache_entry *e;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	do {
+		while ((e = lookup (sector)) != NULL && e->busy)
+			cond_wait (&io_done, &cache_lock);
+		if (e != NULL) {
+			hit_cnt++;
+			e->accessed = true;
+			return e;
+		}
+	} while ((e = claim_entry (sector, read_in, true)) == NULL);
+	miss_cnt++;
+
+	if (read_in) {
+		lock_release (&cache_lock);
+		disk_read (filesys_disk, sector, e->data);
+		lock_acquire (&cache_lock);
+		e->busy = false;
+		cond_broadcast (&io_done, &cache_lock);
+	}
+	return e;
+}
+
+/* Puts SECTOR, which must not be cached, into a free or evicted
+ * entry and returns it, marked BUSY if BUSY is true.  The data is
+ * left for the caller to fill in.
+ *
+ * If the clock picks a dirty entry, writes it back with
+ * cache_lock released and returns a null pointer instead, since
+ * SECTOR may have been cached meanwhile; the caller must check
+ * again and retry.  This keeps one thread's write-back from
+ * stalling every other cache user.
+ *
+ * If every entry is busy, returns a null pointer as well, after
+ * waiting for some I/O to finish if WAIT is true.  A caller that
+ * holds busy entries of its own must not wait, since the entries
+ * it waits for may be held by others waiting in the same way.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+claim_entry (disk_sector_t sector, bool busy, bool wait) {
+	struct cache_entry *e;
+	size_t step;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	/* Clock: give each accessed entry a second chance and skip
+	 * entries with I/O in flight.  Two sweeps are enough to find
+	 * any entry that is not busy. */
+	for (step = 0; ; step++) {
+		if (step == 2 * BUFFER_CACHE_SIZE) {
+			if (wait)
+				cond_wait (&io_done, &cache_lock);
+			return NULL;
+		}
+		e = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+		if (!e->valid)
+			break;
+		if (e->busy)
+			continue;
+		if (!e->accessed) {
+			if (e->dirty) {
+				e->busy = true;
+				e->dirty = false;
+				lock_release (&cache_lock);
+				disk_write (filesys_disk, e->sector, e->data);
+				lock_acquire (&cache_lock);
+				e->busy = false;
+				cond_broadcast (&io_done, &cache_lock);
+				return NULL;
+			}
+			hash_delete (&cache_map, &e->elem);
+			e->valid = false;
+			break;
+		}
+		e->accessed = false;
+	}
+
+	e->sector = sector;
+	e->dirty = false;
+	e->accessed = true;
+	e->valid = true;
+	e->busy = busy;
+	hash_insert (&cache_map, &e->elem);
+	return e;
+}
+
+/* Reads every sector among the CNT starting at SECTOR that is not
+ * cached into an entry whose accessed bit is ACCESSED.  Each run
+ * of up to RUN_MAX missing sectors is read with one command into
+ * a bounce buffer, with cache_lock released.  Falls back to one
+ * sector at a time if the bounce buffer cannot be allocated.
+ * Returns the number of sectors read.
+ * Must be called with cache_lock held. */
+static size_t
+fill_run (disk_sector_t sector, size_t cnt, bool accessed) {
+	struct cache_entry *run[RUN_MAX];
+	disk_sector_t end = sector + cnt;
+	size_t read_cnt = 0;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	while (sector < end) {
+		uint8_t *bounce;
+		size_t n = 0, i;
+
+		if (lookup (sector) != NULL) {
+			sector++;
+			continue;
+		}
+		while (n < RUN_MAX && sector + n < end && lookup (sector + n) == NULL) {
+			/* Checks SECTOR + N again if claim_entry() dropped
+			 * the lock.  Once the run holds entries, reads what it
+			 * has rather than wait for others' I/O. */
+			if ((run[n] = claim_entry (sector + n, true, n == 0)) == NULL) {
+				if (n > 0)
+					break;
+				continue;
+			}
+			run[n]->accessed = accessed;
+			n++;
+		}
+		read_cnt += n;
+
+		lock_release (&cache_lock);
+		bounce = n > 1 ? malloc (n * DISK_SECTOR_SIZE) : NULL;
+		if (bounce != NULL) {
+			disk_read_multi (filesys_disk, sector, n, bounce);
+			for (i = 0; i < n; i++)
+				memcpy (run[i]->data, bounce + i * DISK_SECTOR_SIZE,
+						DISK_SECTOR_SIZE);
+			free (bounce);
+		} else
+			for (i = 0; i < n; i++)
+				disk_read (filesys_disk, sector + i, run[i]->data);
+		lock_acquire (&cache_lock);
+
+		for (i = 0; i < n; i++)
+			run[i]->busy = false;
+		cond_broadcast (&io_done, &cache_lock);
+		sector += n;
+	}
+	return read_cnt;
+}
+
+/* Serves read-ahead requests, merging requests for consecutive
+ * sectors into one disk read.  Prefetched entries start without
+ * their accessed bit, so the clock reclaims them first if the
+ * reader never gets to them. */
+static void
+readahead_daemon (void *aux UNUSED) {
+	for (;;) {
+		disk_sector_t sector;
+		size_t cnt = 1;
+
+		sema_down (&readahead_sema);
+		lock_acquire (&cache_lock);
+		sector = readahead_queue[readahead_head];
+		readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+		readahead_queued--;
+		while (cnt < RUN_MAX && readahead_queued > 0
+				&& readahead_queue[readahead_head] == sector + cnt
+				&& sema_try_down (&readahead_sema)) {
+			readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+			readahead_queued--;
+			cnt++;
+		}
+		readahead_cnt += fill_run (sector, cnt, false);
+		lock_release (&cache_lock);
+	}
+}
+
+/* Periodically writes back sectors that have been dirty for
+ * longer than buffer_cache_flush_ms, along with the changed FAT
+ * sectors, so that write-back cost is spread out instead of all
+ * landing on filesys_done. */
+static void
+flush_daemon (void *aux UNUSED) {
+	for (;;) {
+		int64_t interval = (int64_t) buffer_cache_flush_ms * TIMER_FREQ / 1000;
+
+		if (interval < 1)
+			interval = 1;
+		timer_sleep (interval);
+		flush_old (timer_ticks () - interval);
+#ifdef EFILESYS
+		fat_flush ();
+#endif
+	}
+}
+
+/* Writes back the dirty entries that became dirty at or before
+ * tick CUTOFF, up to FLUSH_BATCH_MAX of them with the lowest
+ * sector numbers.  They are written in ascending sector order in
+ * a single pass, with cache_lock released, and each run of
+ * consecutive sectors goes out in one disk command.  The entries
+ * are marked busy meanwhile so that nobody changes or evicts
+ * them. */
+static void
+flush_old (int64_t cutoff) {
+	struct cache_entry *batch[FLUSH_BATCH_MAX];
+	uint8_t *bounce;
+	size_t cnt = 0, i, j;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+		if (!e->valid || !e->dirty || e->busy || e->dirty_since > cutoff)
+			continue;
+		if (cnt == FLUSH_BATCH_MAX && batch[cnt - 1]->sector < e->sector)
+			continue;
+
+		/* Insertion sort by sector number, dropping the highest
+		 * sector if the batch is full. */
+		if (cnt < FLUSH_BATCH_MAX)
+			cnt++;
+		for (j = cnt - 1; j > 0 && batch[j - 1]->sector > e->sector; j--)
+			batch[j] = batch[j - 1];
+		batch[j] = e;
+	}
+	for (i = 0; i < cnt; i++) {
+		batch[i]->busy = true;
+		batch[i]->dirty = false;
+	}
+	lock_release (&cache_lock);
+
+	if (cnt == 0)
+		return;
+	bounce = malloc (RUN_MAX * DISK_SECTOR_SIZE);
+	for (i = 0; i < cnt; i += j) {
+		/* Find the run of consecutive sectors starting at I. */
+		for (j = 1; bounce != NULL && j < RUN_MAX && i + j < cnt
+				&& batch[i + j]->sector == batch[i]->sector + j; j++)
+			continue;
+		if (j == 1)
+			disk_write (filesys_disk, batch[i]->sector, batch[i]->data);
+		else {
+			size_t k;
+			for (k = 0; k < j; k++)
+				memcpy (bounce + k * DISK_SECTOR_SIZE, batch[i + k]->data,
+						DISK_SECTOR_SIZE);
+			disk_write_multi (filesys_disk, batch[i]->sector, j, bounce);
+		}
+	}
+	free (bounce);
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < cnt; i++)
+		batch[i]->busy = false;
+	flush_cnt += cnt;
+	cond_broadcast (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Writes E back to disk if it is dirty. */
+static void
+write_back (struct cache_entry *e) {
+	if (e->dirty) {
+		disk_write (filesys_disk, e->sector, e->data);
+		e->dirty = false;
+	}
+}
+
+static uint64_t
+cache_hash (const struct hash_elem *e_, void *aux UNUSED) {
+	const struct cache_entry *e = hash_entry (e_, struct cache_entry, elem);
+	return hash_int (e->sector);
+}
+
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cache_entry *a = hash_entry (a_, struct cache_entry, elem);
+	const struct cache_entry *b = hash_entry (b_, struct cache_entry, elem);
+	return a->sector < b->sector;
+}
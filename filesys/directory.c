@@ -1,15 +1,18 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
 	struct inode *inode;                /* Backing store. */
-	off_t pos;                          /* Current position. */
+	off_t pos;                          /* Current entry slot. */
 };
 
 /* A single directory entry. */
@@ -19,11 +22,241 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* A directory starts out as a flat array of entries that is
+ * searched linearly.  Once it outgrows DIR_LINEAR_MAX bytes, it
+ * is converted to a hashed layout: an array of sector-sized
+ * buckets, where the entry for NAME lives in bucket
+ * hash_string (NAME) % bucket count, or in one of the buckets
+ * after it if that one was full.  A lookup then costs one sector
+ * read, or a few when buckets overflowed, however large the
+ * directory is.
+ *
+ * Which layout a directory uses follows from its length alone,
+ * and a zero-filled file is an empty directory in either one. */
+#define DIR_LINEAR_MAX (32 * sizeof (struct dir_entry))
+#define BUCKET_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define DIR_MIN_BUCKETS 4       /* Buckets in a new hashed directory. */
+#define DIR_MAX_PROBE 4         /* Buckets to try before growing. */
+
+/* A bucket of a hashed directory.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct dir_bucket {
+	struct dir_entry entries[BUCKET_ENTRIES];
+	bool overflow;          /* An entry was pushed on to a later bucket. */
+	uint8_t unused[DISK_SECTOR_SIZE - sizeof (struct dir_entry) * BUCKET_ENTRIES
+		- sizeof (bool)];
+};
+
+/* Directory entry cache.
+ *
+ * Maps a (directory inode sector, name) pair to the sector of the
+ * named inode, and also remembers names that were looked up and
+ * not found, so that resolving the same name again, or checking
+ * again that it does not exist, needs no directory read at all.
+ * dir_add() and dir_remove() keep the cache up to date, and the
+ * entries of a directory are dropped when its sector is reused or
+ * removed.  Replacement is LRU.
+ *
+ * Nothing keeps a directory from changing while dir_lookup() reads
+ * it, so what a lookup found may be out of date by the time it is
+ * cached.  Every change bumps dcache_gen, and a lookup's result is
+ * cached only if the generation is still the one from before the
+ * directory was read. */
+#define DCACHE_SIZE 128
+
+struct dcache_entry {
+	struct hash_elem hash_elem;         /* Element in dcache_map. */
+	struct list_elem lru_elem;          /* Element in dcache_lru. */
+	bool valid;                         /* In dcache_map? */
+	disk_sector_t parent;               /* Sector of the directory. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	bool present;                       /* False caches a failed lookup. */
+	disk_sector_t inode_sector;         /* Sector of the inode, if present. */
+};
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct hash dcache_map;          /* Valid entries by key. */
+static struct list dcache_lru;          /* All entries, most recent first. */
+static struct lock dcache_lock;
+static unsigned dcache_gen;             /* Bumped by every change. */
+
+static long long dcache_hit_cnt;        /* Lookups served from the cache. */
+static long long dcache_miss_cnt;       /* Lookups that read the directory. */
+
+static uint64_t
+dcache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dcache_entry *d = hash_entry (e, struct dcache_entry, hash_elem);
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dcache_entry *a = hash_entry (a_, struct dcache_entry, hash_elem);
+	const struct dcache_entry *b = hash_entry (b_, struct dcache_entry, hash_elem);
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	size_t i;
+
+	hash_init (&dcache_map, dcache_hash, dcache_less, NULL);
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		dcache[i].valid = false;
+		list_push_back (&dcache_lru, &dcache[i].lru_elem);
+	}
+}
+
+/* Returns the cache entry for NAME in the directory at sector
+ * PARENT, or a null pointer.  NAME must be at most NAME_MAX
+ * characters long, or it would match a shorter name.  Must be
+ * called with dcache_lock held. */
+static struct dcache_entry *
+dcache_find (disk_sector_t parent, const char *name) {
+	struct dcache_entry key;
+	struct hash_elem *e;
+
+	ASSERT (strlen (name) <= NAME_MAX);
+
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache_map, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory at sector PARENT in the cache.
+ * Returns true on a hit, setting *PRESENT and, if the name
+ * exists, *SECTORP. */
+static bool
+dcache_lookup (disk_sector_t parent, const char *name, bool *present,
+		disk_sector_t *sectorp) {
+	struct dcache_entry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&dcache_lru, &d->lru_elem);
+		*present = d->present;
+		*sectorp = d->inode_sector;
+		dcache_hit_cnt++;
+	} else
+		dcache_miss_cnt++;
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Returns the current cache generation, for dcache_fill(). */
+static unsigned
+dcache_generation (void) {
+	unsigned gen;
+
+	lock_acquire (&dcache_lock);
+	gen = dcache_gen;
+	lock_release (&dcache_lock);
+	return gen;
+}
+
+/* Records in the cache that NAME in the directory at sector
+ * PARENT refers to INODE_SECTOR, or does not exist if PRESENT is
+ * false.  Must be called with dcache_lock held. */
+static void
+dcache_put (disk_sector_t parent, const char *name, bool present,
+		disk_sector_t inode_sector) {
+	struct dcache_entry *d;
+
+	ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+	d = dcache_find (parent, name);
+	if (d == NULL) {
+		d = list_entry (list_back (&dcache_lru), struct dcache_entry, lru_elem);
+		if (d->valid)
+			hash_delete (&dcache_map, &d->hash_elem);
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		d->valid = true;
+		hash_insert (&dcache_map, &d->hash_elem);
+	}
+	d->present = present;
+	d->inode_sector = inode_sector;
+	list_remove (&d->lru_elem);
+	list_push_front (&dcache_lru, &d->lru_elem);
+}
+
+/* Records a change to the directory at sector PARENT: NAME now
+ * refers to INODE_SECTOR, or no longer exists if PRESENT is
+ * false. */
+static void
+dcache_store (disk_sector_t parent, const char *name, bool present,
+		disk_sector_t inode_sector) {
+	lock_acquire (&dcache_lock);
+	dcache_gen++;
+	dcache_put (parent, name, present, inode_sector);
+	lock_release (&dcache_lock);
+}
+
+/* Caches what a lookup of NAME in the directory at sector PARENT
+ * found, as for dcache_store(), unless some directory changed
+ * since dcache_generation() returned GEN. */
+static void
+dcache_fill (disk_sector_t parent, const char *name, bool present,
+		disk_sector_t inode_sector, unsigned gen) {
+	lock_acquire (&dcache_lock);
+	if (gen == dcache_gen)
+		dcache_put (parent, name, present, inode_sector);
+	lock_release (&dcache_lock);
+}
+
+/* Drops every cache entry that points into or at the inode in
+ * SECTOR, whose old contents are gone. */
+static void
+dcache_forget (disk_sector_t sector) {
+	size_t i;
+
+	lock_acquire (&dcache_lock);
+	dcache_gen++;
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		struct dcache_entry *d = &dcache[i];
+		if (d->valid && (d->parent == sector
+					|| (d->present && d->inode_sector == sector))) {
+			hash_delete (&dcache_map, &d->hash_elem);
+			d->valid = false;
+			list_remove (&d->lru_elem);
+			list_push_back (&dcache_lru, &d->lru_elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dir_print_stats (void) {
+	printf ("Dcache: %lld hits, %lld misses\n",
+			dcache_hit_cnt, dcache_miss_cnt);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	size_t size = entry_cnt * sizeof (struct dir_entry);
+
+	ASSERT (sizeof (struct dir_bucket) == DISK_SECTOR_SIZE);
+
+	if (size > DIR_LINEAR_MAX) {
+		size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+		if (bucket_cnt < DIR_MIN_BUCKETS)
+			bucket_cnt = DIR_MIN_BUCKETS;
+		size = bucket_cnt * DISK_SECTOR_SIZE;
+	}
+	dcache_forget (sector);
+	return inode_create (sector, size);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -71,6 +304,80 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+/* Returns true if DIR uses the hashed layout. */
+static bool
+is_hashed (const struct dir *dir) {
+	return inode_length (dir->inode) > (off_t) DIR_LINEAR_MAX;
+}
+
+/* Returns the number of buckets in hashed directory DIR. */
+static size_t
+bucket_cnt (const struct dir *dir) {
+	return inode_length (dir->inode) / DISK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of entry slot SLOT in DIR. */
+static off_t
+slot_ofs (const struct dir *dir, size_t slot) {
+	if (!is_hashed (dir))
+		return slot * sizeof (struct dir_entry);
+	return slot / BUCKET_ENTRIES * DISK_SECTOR_SIZE
+		+ slot % BUCKET_ENTRIES * sizeof (struct dir_entry);
+}
+
+/* Reads bucket IDX of DIR into B.  Returns true if successful. */
+static bool
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b) {
+	return inode_read_at (dir->inode, b, sizeof *b,
+			idx * DISK_SECTOR_SIZE) == sizeof *b;
+}
+
+/* Writes B to bucket IDX of DIR.  Returns true if successful. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_bucket *b) {
+	return inode_write_at (dir->inode, b, sizeof *b,
+			idx * DISK_SECTOR_SIZE) == sizeof *b;
+}
+
+/* Searches hashed directory DIR for NAME, like lookup().
+ * The search starts at NAME's home bucket and moves on to the
+ * next bucket only as long as the current one has overflowed. */
+static bool
+lookup_hashed (const struct dir *dir, const char *name,
+		struct dir_entry *ep, off_t *ofsp) {
+	size_t cnt = bucket_cnt (dir);
+	size_t home = hash_string (name) % cnt;
+	struct dir_bucket *b;
+	bool found = false;
+	size_t i, j;
+
+	b = malloc (sizeof *b);
+	if (b == NULL)
+		return false;
+
+	for (i = 0; i < cnt && !found; i++) {
+		size_t idx = (home + i) % cnt;
+
+		if (!read_bucket (dir, idx, b))
+			break;
+		for (j = 0; j < BUCKET_ENTRIES; j++) {
+			struct dir_entry *e = &b->entries[j];
+			if (e->in_use && !strcmp (name, e->name)) {
+				if (ep != NULL)
+					*ep = *e;
+				if (ofsp != NULL)
+					*ofsp = idx * DISK_SECTOR_SIZE + j * sizeof *e;
+				found = true;
+				break;
+			}
+		}
+		if (!b->overflow)
+			break;
+	}
+	free (b);
+	return found;
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -85,6 +392,9 @@ lookup (const struct dir *dir, const char *name,
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	if (is_hashed (dir))
+		return lookup_hashed (dir, name, ep, ofsp);
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -104,19 +414,117 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t parent;
 	struct dir_entry e;
+	bool present;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
+	/* No entry can have a longer name.  The cache stores names of
+	 * at most NAME_MAX characters, so a longer one must not reach
+	 * it. */
+	*inode = NULL;
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	parent = inode_get_inumber (dir->inode);
+	if (!dcache_lookup (parent, name, &present, &e.inode_sector)) {
+		unsigned gen = dcache_generation ();
+
+		present = lookup (dir, name, &e, NULL);
+		dcache_fill (parent, name, present, e.inode_sector, gen);
+	}
+
+	if (present)
 		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
 
 	return *inode != NULL;
 }
 
+/* Stores E in hashed directory DIR, trying at most MAX_PROBE
+ * buckets starting from E's home bucket.  B is scratch space.
+ * Returns false if all of those buckets are full or if a disk
+ * error occurs. */
+static bool
+insert_hashed (struct dir *dir, const struct dir_entry *e,
+		struct dir_bucket *b, size_t max_probe) {
+	size_t cnt = bucket_cnt (dir);
+	size_t home = hash_string (e->name) % cnt;
+	size_t i, j;
+
+	for (i = 0; i < max_probe && i < cnt; i++) {
+		size_t idx = (home + i) % cnt;
+
+		if (!read_bucket (dir, idx, b))
+			return false;
+		for (j = 0; j < BUCKET_ENTRIES; j++)
+			if (!b->entries[j].in_use) {
+				b->entries[j] = *e;
+				return write_bucket (dir, idx, b);
+			}
+		if (!b->overflow) {
+			b->overflow = true;
+			if (!write_bucket (dir, idx, b))
+				return false;
+		}
+	}
+	return false;
+}
+
+/* Rebuilds DIR as a hashed directory that has room for at least
+ * EXTRA more entries than it holds now, keeping the load factor
+ * at or below one half.  Works for both layouts.
+ * Returns true if successful.  On failure DIR is unchanged,
+ * unless a disk error occurs after the file has been extended. */
+static bool
+rehash (struct dir *dir, size_t extra) {
+	size_t slot_cnt, entry_cnt = 0, new_cnt, i;
+	struct dir_entry *entries;
+	struct dir_bucket *b;
+	bool success = false;
+
+	/* Gather the live entries. */
+	slot_cnt = is_hashed (dir) ? bucket_cnt (dir) * BUCKET_ENTRIES
+		: inode_length (dir->inode) / sizeof (struct dir_entry);
+	entries = malloc (slot_cnt * sizeof *entries);
+	b = calloc (1, sizeof *b);
+	if ((entries == NULL && slot_cnt > 0) || b == NULL)
+		goto done;
+	for (i = 0; i < slot_cnt; i++) {
+		struct dir_entry e;
+		if (inode_read_at (dir->inode, &e, sizeof e, slot_ofs (dir, i))
+				!= sizeof e)
+			goto done;
+		if (e.in_use)
+			entries[entry_cnt++] = e;
+	}
+
+	new_cnt = is_hashed (dir) ? bucket_cnt (dir) * 2 : DIR_MIN_BUCKETS;
+	while (new_cnt * BUCKET_ENTRIES < 2 * (entry_cnt + extra))
+		new_cnt *= 2;
+
+	/* Extend the file first, so that running out of disk space
+	 * leaves the old contents alone, then clear every bucket. */
+	if (!write_bucket (dir, new_cnt - 1, b))
+		goto done;
+	for (i = 0; i + 1 < new_cnt; i++)
+		if (!write_bucket (dir, i, b))
+			goto done;
+
+	/* Put the entries back.  At this load factor every entry
+	 * fits somewhere, so only a disk error can fail. */
+	for (i = 0; i < entry_cnt; i++)
+		if (!insert_hashed (dir, &entries[i], b, new_cnt))
+			goto done;
+	success = true;
+
+done:
+	free (entries);
+	free (b);
+	return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
  * INODE_SECTOR.
@@ -126,7 +534,9 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	struct dir_entry e;
+	struct dir_bucket *b = NULL;
 	off_t ofs;
+	bool present;
 	bool success = false;
 
 	ASSERT (dir != NULL);
@@ -136,29 +546,55 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	/* Check that NAME is not in use.  A cached miss saves the
+	 * directory scan. */
+	if (!dcache_lookup (inode_get_inumber (dir->inode), name, &present,
+				&e.inode_sector))
+		present = lookup (dir, name, NULL, NULL);
+	if (present)
 		goto done;
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	if (!is_hashed (dir)) {
+		/* Set OFS to offset of free slot.
+		 * If there are no free slots, then it will be set to the
+		 * current end-of-file.
+
+		 * inode_read_at() will only return a short read at end of file.
+		 * Otherwise, we'd need to verify that we didn't get a short
+		 * read due to something intermittent such as low memory. */
+		for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+				ofs += sizeof e)
+			if (!e.in_use)
+				break;
+
+		/* Write slot, unless that would grow the directory past
+		 * DIR_LINEAR_MAX, in which case switch to the hashed layout. */
+		if (ofs + sizeof e <= DIR_LINEAR_MAX) {
+			e.in_use = true;
+			strlcpy (e.name, name, sizeof e.name);
+			e.inode_sector = inode_sector;
+			success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			goto done;
+		}
+		if (!rehash (dir, 1))
+			goto done;
+	}
 
-	/* Write slot. */
+	/* Insert into the hashed layout, growing the table if the
+	 * entry's home bucket and the ones after it are full. */
+	b = malloc (sizeof *b);
+	if (b == NULL)
+		goto done;
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
-	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	success = insert_hashed (dir, &e, b, DIR_MAX_PROBE)
+		|| (rehash (dir, 1) && insert_hashed (dir, &e, b, bucket_cnt (dir)));
 
 done:
+	if (success)
+		dcache_store (inode_get_inumber (dir->inode), name, true, inode_sector);
+	free (b);
 	return success;
 }
 
@@ -191,6 +627,8 @@ dir_remove (struct dir *dir, const char *name) {
 
 	/* Remove inode. */
 	inode_remove (inode);
+	dcache_store (inode_get_inumber (dir->inode), name, false, 0);
+	dcache_forget (e.inode_sector);
 	success = true;
 
 done:
@@ -205,8 +643,9 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
 
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-		dir->pos += sizeof e;
+	while (inode_read_at (dir->inode, &e, sizeof e, slot_ofs (dir, dir->pos))
+			== sizeof e) {
+		dir->pos++;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
 			return true;
@@ -1,4 +1,5 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -20,9 +21,11 @@ struct fat_boot {
 struct fat_fs {
 	struct fat_boot bs;
 	unsigned int *fat;
+	struct bitmap *dirty;       /* FAT sectors changed since last flush. */
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;        /* Last cluster handed out. */
+	size_t free_cnt;            /* Number of free clusters. */
 	struct lock write_lock;
 };
 
@@ -30,6 +33,8 @@ static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_count_free (void);
+static void fat_index_mark (struct fat_index *, size_t idx, cluster_t clst);
 
 void
 fat_init (void) {
@@ -51,33 +56,30 @@ fat_init (void) {
 	fat_fs_init ();
 }
 
+/* Allocates an empty in-memory FAT, padded to whole sectors so
+ * that every FAT sector can be read and written in place. */
+static void
+fat_alloc_table (void) {
+	ASSERT (fat_fs->fat_length * sizeof (cluster_t)
+			<= fat_fs->bs.fat_sectors * DISK_SECTOR_SIZE);
+	fat_fs->fat = calloc (fat_fs->bs.fat_sectors, DISK_SECTOR_SIZE);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->fat == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT allocation failed");
+}
+
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
-
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
-	}
+	/* Right after formatting, the table in memory is already
+	 * up to date. */
+	if (fat_fs->fat != NULL)
+		return;
+	fat_alloc_table ();
+
+	// Load FAT directly from the disk, in as few commands as possible
+	disk_read_multi (filesys_disk, fat_fs->bs.fat_start, fat_fs->bs.fat_sectors,
+	                 fat_fs->fat);
+	fat_count_free ();
 }
 
 void
@@ -90,27 +92,38 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
+	// Write back the FAT sectors that changed
+	fat_flush ();
+}
+
+/* Writes the FAT sectors changed since the last flush to disk.
+ * fat_put() marks the sector it touches dirty, so a shutdown or
+ * a periodic flush costs one write per run of changed sectors
+ * instead of rewriting the whole table.  A sector changed while it is being
+ * written is marked dirty again and goes out on the next flush. */
+void
+fat_flush (void) {
+	uint8_t *buffer;
+	size_t i = 0;
+
+	if (fat_fs == NULL || fat_fs->dirty == NULL)
+		return;
+
+	buffer = (uint8_t *) fat_fs->fat;
+	lock_acquire (&fat_fs->write_lock);
+	while ((i = bitmap_scan (fat_fs->dirty, i, 1, true)) != BITMAP_ERROR) {
+		/* Write each run of dirty sectors with one command. */
+		size_t end = bitmap_scan (fat_fs->dirty, i, 1, false);
+		if (end == BITMAP_ERROR)
+			end = fat_fs->bs.fat_sectors;
+		bitmap_set_multiple (fat_fs->dirty, i, end - i, false);
+		lock_release (&fat_fs->write_lock);
+		disk_write_multi (filesys_disk, fat_fs->bs.fat_start + i, end - i,
+		                  buffer + i * DISK_SECTOR_SIZE);
+		lock_acquire (&fat_fs->write_lock);
+		i = end;
 	}
+	lock_release (&fat_fs->write_lock);
 }
 
 void
@@ -119,13 +132,13 @@ fat_create (void) {
 	fat_boot_create ();
 	fat_fs_init ();
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	// Create FAT table, all of which must be written out
+	fat_alloc_table ();
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
+	fat_count_free ();
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
@@ -152,42 +165,206 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Data clusters start right after the FAT.  Entry 0 of the FAT
+	 * is unused, so that cluster number 0 can mean "no cluster". */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Counts the free clusters in the loaded FAT. */
+static void
+fat_count_free (void) {
+	cluster_t i;
+
+	fat_fs->free_cnt = 0;
+	for (i = ROOT_DIR_CLUSTER + 1; i < fat_fs->fat_length; i++)
+		if (fat_fs->fat[i] == 0)
+			fat_fs->free_cnt++;
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Returns a free cluster, or 0 if there is none.
+ * The cluster right after TAIL is preferred, so that a growing
+ * chain stays contiguous on disk.  Otherwise the search resumes
+ * where the previous one stopped (next fit), which keeps the cost
+ * O(1) amortized instead of rescanning the allocated clusters at
+ * the front of the FAT every time. */
+static cluster_t
+fat_find_free (cluster_t tail) {
+	const cluster_t first = ROOT_DIR_CLUSTER + 1;
+	cluster_t clst;
+	size_t i;
+
+	if (fat_fs->free_cnt == 0)
+		return 0;
+	if (tail != 0 && tail + 1 < fat_fs->fat_length
+			&& fat_fs->fat[tail + 1] == 0)
+		return tail + 1;
+
+	clst = fat_fs->last_clst;
+	for (i = first; i < fat_fs->fat_length; i++) {
+		if (++clst >= fat_fs->fat_length)
+			clst = first;
+		if (fat_fs->fat[clst] == 0)
+			return clst;
+	}
+	NOT_REACHED ();
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new_clst;
+
+	lock_acquire (&fat_fs->write_lock);
+	new_clst = fat_find_free (clst);
+	if (new_clst != 0) {
+		fat_put (new_clst, EOChain);
+		if (clst != 0)
+			fat_put (clst, new_clst);
+		fat_fs->last_clst = new_clst;
+		fat_fs->free_cnt--;
+	}
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_put (pclst, EOChain);
+	while (clst != EOChain && clst != 0) {
+		cluster_t next = fat_get (clst);
+		fat_put (clst, 0);
+		fat_fs->free_cnt++;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty,
+	             clst / (DISK_SECTOR_SIZE / sizeof (cluster_t)));
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Covert a sector number to the cluster # that holds it. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Cluster index                                                              */
+/*----------------------------------------------------------------------------*/
+
+/* Initializes INDEX for the chain that starts at HEAD, which may
+ * be 0 for an empty chain. */
+void
+fat_index_init (struct fat_index *index, cluster_t head) {
+	index->marks = NULL;
+	index->mark_cnt = 0;
+	index->mark_cap = 0;
+	index->last_idx = 0;
+	index->last_clst = 0;
+	index->hop_cnt = 0;
+	if (head != 0)
+		fat_index_mark (index, 0, head);
+}
+
+/* Frees the memory held by INDEX. */
+void
+fat_index_destroy (struct fat_index *index) {
+	free (index->marks);
+	index->marks = NULL;
+	index->mark_cnt = index->mark_cap = 0;
+	index->last_clst = 0;
+}
+
+/* Records that cluster IDX of the chain is CLST, if IDX is the
+ * next checkpoint INDEX is missing.  Running out of memory just
+ * leaves the checkpoint out. */
+static void
+fat_index_mark (struct fat_index *index, size_t idx, cluster_t clst) {
+	if (idx % FAT_INDEX_STRIDE != 0 || idx / FAT_INDEX_STRIDE != index->mark_cnt)
+		return;
+	if (index->mark_cnt == index->mark_cap) {
+		size_t cap = index->mark_cap ? index->mark_cap * 2 : 8;
+		cluster_t *marks = realloc (index->marks, cap * sizeof *marks);
+		if (marks == NULL)
+			return;
+		index->marks = marks;
+		index->mark_cap = cap;
+	}
+	index->marks[index->mark_cnt++] = clst;
+}
+
+/* Returns cluster number IDX (counting from 0) of the chain that
+ * INDEX describes, or 0 if the chain is shorter than that.
+ * The walk starts from the last lookup when it is close enough
+ * behind IDX, and otherwise from the nearest checkpoint, so it
+ * takes fewer than FAT_INDEX_STRIDE hops once the checkpoints up
+ * to IDX are known.
+ * LAST_IDX and LAST_CLST only mean something as a pair, and the
+ * checkpoint array may be reallocated, so the caller must hold
+ * whatever lock guards INDEX. */
+cluster_t
+fat_index_lookup (struct fat_index *index, size_t idx) {
+	size_t pos, mark;
+	cluster_t clst;
+
+	if (index->mark_cnt == 0)
+		return 0;
+
+	mark = idx / FAT_INDEX_STRIDE;
+	if (mark >= index->mark_cnt)
+		mark = index->mark_cnt - 1;
+	pos = mark * FAT_INDEX_STRIDE;
+	clst = index->marks[mark];
+	if (index->last_clst != 0 && index->last_idx <= idx && index->last_idx > pos) {
+		pos = index->last_idx;
+		clst = index->last_clst;
+	}
+
+	while (pos < idx) {
+		clst = fat_get (clst);
+		index->hop_cnt++;
+		if (clst == EOChain || clst == 0)
+			return 0;
+		pos++;
+		fat_index_mark (index, pos, clst);
+	}
+
+	index->last_idx = idx;
+	index->last_clst = clst;
+	return clst;
 }
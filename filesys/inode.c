@@ -1,23 +1,83 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/buffer-cache.h"
+#include "filesys/fat.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifdef EFILESYS
+/* On-disk inode.  The data lives in a FAT cluster chain.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	cluster_t start;                    /* First data cluster, or 0. */
+	uint32_t sector_cnt;                /* Data sectors in the chain. */
+	uint32_t unused[124];               /* Not used. */
+};
+
+/* In-memory state for finding an inode's data sectors. */
+struct inode_map {
+	struct fat_index index;             /* Checkpoints into the chain. */
+};
+#else
+/* A run of LENGTH consecutive data sectors starting at START. */
+struct extent {
+	disk_sector_t start;                /* First sector of the run. */
+	uint32_t length;                    /* Number of sectors in the run. */
+};
+
+/* Number of extents stored in the inode itself and in each
+ * extent block.  The first extent block is the inode's indirect
+ * block.  The rest hang off its doubly indirect blocks, each of
+ * which holds the sectors of DTABLE_ENTRIES extent blocks.
+ * MAX_EXTENTS is more than the sectors on an 8 MB file system
+ * disk, so even a file made of one-sector runs can fill it. */
+#define DIRECT_EXTENTS 60
+#define INDIRECT_EXTENTS (DISK_SECTOR_SIZE / sizeof (struct extent))
+#define DINDIRECT_BLOCKS 2
+#define DTABLE_ENTRIES (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+#define DBLOCK_MAX (DINDIRECT_BLOCKS * DTABLE_ENTRIES)
+#define MAX_EXTENTS (DIRECT_EXTENTS + INDIRECT_EXTENTS \
+		+ DBLOCK_MAX * INDIRECT_EXTENTS)
+
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents in use. */
+	uint32_t sector_cnt;                /* Data sectors in all extents. */
+	disk_sector_t indirect;             /* Indirect extent block, or 0. */
+	disk_sector_t dindirect[DINDIRECT_BLOCKS]; /* Doubly indirect, or 0. */
+	struct extent direct[DIRECT_EXTENTS]; /* First extents, in file order. */
+	uint32_t unused;                    /* Not used. */
+};
+
+/* In-memory state for finding an inode's data sectors.  Every
+ * extent block of an open inode is kept in memory. */
+struct inode_map {
+	struct extent *indirect;            /* Indirect extents, if any. */
+	disk_sector_t *dtable;              /* Doubly indirect blocks, if any. */
+	struct extent **dblocks;            /* Extent blocks listed in DTABLE. */
+	uint32_t dirty_idx;                 /* First extent changed since the
+	                                       last inode_write_disk(). */
+	uint32_t hint_idx;                  /* Extent found by the last lookup. */
+	uint32_t hint_first;                /* First file sector of that extent. */
 };
+#endif
 
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
@@ -28,35 +88,507 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
+	struct list_elem pool_elem;         /* Element in inode_pool if free. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	off_t ra_next;                      /* Where a sequential read would start. */
+	off_t ra_end;                       /* End of the queued read-ahead window. */
+	struct lock map_lock;               /* Serializes lookups and growth. */
+	struct inode_map map;               /* Where the data sectors are. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Lookup statistics. */
+static long long lookup_cnt;            /* Calls to byte_to_sector. */
+static long long map_step_cnt;          /* Extents or FAT entries examined. */
+static long long open_call_cnt;         /* Calls to inode_open. */
+static long long open_cmp_cnt;          /* Comparisons in open_inodes. */
+
+static bool map_open (struct inode_map *, struct inode_disk *);
+static void map_close (struct inode_map *);
+static disk_sector_t map_lookup (struct inode_disk *, struct inode_map *,
+		uint32_t sector_ofs);
+static bool inode_extend (struct inode_disk *, struct inode_map *,
+		off_t length);
+static void inode_release (struct inode_disk *, struct inode_map *);
+static void inode_write_disk (disk_sector_t, struct inode_disk *,
+		struct inode_map *);
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos) {
+	disk_sector_t sector;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	if (pos >= inode->data.length)
 		return -1;
+
+	/* The map keeps where the last lookup ended up, which another
+	 * opener's lookup or write would otherwise change underneath. */
+	lock_acquire (&inode->map_lock);
+	lookup_cnt++;
+	sector = map_lookup (&inode->data, &inode->map, pos / DISK_SECTOR_SIZE);
+	lock_release (&inode->map_lock);
+	return sector;
+}
+
+/* Prints inode lookup statistics. */
+void
+inode_print_stats (void) {
+	printf ("Inode: %lld sector lookups, %lld map steps, "
+			"%lld opens, %lld open table compares\n",
+			lookup_cnt, map_step_cnt, open_call_cnt, open_cmp_cnt);
+}
+
+#ifdef EFILESYS
+/* Allocates a sector for a new inode and stores it into *SECTORP.
+ * Returns true if successful. */
+bool
+inode_allocate_sector (disk_sector_t *sectorp) {
+	cluster_t clst = fat_create_chain (0);
+	if (clst == 0)
+		return false;
+	*sectorp = cluster_to_sector (clst);
+	return true;
+}
+
+/* Frees SECTOR, which was allocated by inode_allocate_sector(). */
+void
+inode_release_sector (disk_sector_t sector) {
+	fat_remove_chain (sector_to_cluster (sector), 0);
+}
+
+/* Sets up MAP for DATA. */
+static bool
+map_open (struct inode_map *map, struct inode_disk *data) {
+	fat_index_init (&map->index, data->start);
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Frees the memory held by MAP. */
+static void
+map_close (struct inode_map *map) {
+	fat_index_destroy (&map->index);
+}
+
+/* Returns the disk sector of file sector SECTOR_OFS.  The cluster
+ * index makes this cost at most FAT_INDEX_STRIDE chain hops.
+ * The caller must keep other lookups and inode_extend() off MAP
+ * meanwhile, since both move the index's last lookup. */
+static disk_sector_t
+map_lookup (struct inode_disk *data UNUSED, struct inode_map *map,
+		uint32_t sector_ofs) {
+	long long hops = map->index.hop_cnt;
+	cluster_t clst = fat_index_lookup (&map->index,
+			sector_ofs / SECTORS_PER_CLUSTER);
+
+	ASSERT (clst != 0);
+	map_step_cnt += map->index.hop_cnt - hops;
+	return cluster_to_sector (clst) + sector_ofs % SECTORS_PER_CLUSTER;
+}
+
+/* Grows the data of DATA to cover LENGTH bytes, appending zeroed
+ * clusters to the chain.
+ * Clusters allocated before a failure stay in the chain.
+ * Returns true if successful. */
+static bool
+inode_extend (struct inode_disk *data, struct inode_map *map, off_t length) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t want = ROUND_UP (bytes_to_sectors (length), SECTORS_PER_CLUSTER);
+
+	while (data->sector_cnt < want) {
+		size_t clst_cnt = data->sector_cnt / SECTORS_PER_CLUSTER;
+		cluster_t last = clst_cnt > 0
+			? fat_index_lookup (&map->index, clst_cnt - 1) : 0;
+		cluster_t clst = fat_create_chain (last);
+		size_t i;
+
+		if (clst == 0)
+			return false;
+		if (data->start == 0) {
+			data->start = clst;
+			fat_index_init (&map->index, clst);
+		}
+		for (i = 0; i < SECTORS_PER_CLUSTER; i++)
+			buffer_cache_write (cluster_to_sector (clst) + i, zeros);
+		data->sector_cnt += SECTORS_PER_CLUSTER;
+	}
+	if (length > data->length)
+		data->length = length;
+	return true;
+}
+
+/* Releases the cluster chain of DATA. */
+static void
+inode_release (struct inode_disk *data, struct inode_map *map UNUSED) {
+	if (data->start != 0)
+		fat_remove_chain (data->start, 0);
+}
+
+/* Writes DATA to SECTOR. */
+static void
+inode_write_disk (disk_sector_t sector, struct inode_disk *data,
+		struct inode_map *map UNUSED) {
+	buffer_cache_write (sector, data);
+}
+#else
+/* Allocates a sector for a new inode and stores it into *SECTORP.
+ * Returns true if successful. */
+bool
+inode_allocate_sector (disk_sector_t *sectorp) {
+	return free_map_allocate (1, sectorp);
+}
+
+/* Frees SECTOR, which was allocated by inode_allocate_sector(). */
+void
+inode_release_sector (disk_sector_t sector) {
+	free_map_release (sector, 1);
+}
+
+/* Returns extent IDX of the inode whose on-disk data is DATA and
+ * whose extent blocks are in MAP. */
+static struct extent *
+extent_at (struct inode_disk *data, struct inode_map *map, uint32_t idx) {
+	ASSERT (idx < MAX_EXTENTS);
+	if (idx < DIRECT_EXTENTS)
+		return &data->direct[idx];
+	idx -= DIRECT_EXTENTS;
+	if (idx < INDIRECT_EXTENTS) {
+		ASSERT (map->indirect != NULL);
+		return &map->indirect[idx];
+	}
+	idx -= INDIRECT_EXTENTS;
+	ASSERT (map->dblocks != NULL && map->dblocks[idx / INDIRECT_EXTENTS] != NULL);
+	return &map->dblocks[idx / INDIRECT_EXTENTS][idx % INDIRECT_EXTENTS];
+}
+
+/* Returns the extent block that holds extent IDX, counting the
+ * indirect block as 0, or -1 for a direct extent. */
+static int
+extent_block (uint32_t idx) {
+	if (idx < DIRECT_EXTENTS)
+		return -1;
+	return (idx - DIRECT_EXTENTS) / INDIRECT_EXTENTS;
+}
+
+/* Allocates the doubly indirect tables of MAP.
+ * Returns false if memory allocation fails. */
+static bool
+map_alloc_dtable (struct inode_map *map) {
+	if (map->dtable != NULL)
+		return true;
+	map->dtable = calloc (DBLOCK_MAX, sizeof *map->dtable);
+	map->dblocks = calloc (DBLOCK_MAX, sizeof *map->dblocks);
+	if (map->dtable == NULL || map->dblocks == NULL) {
+		free (map->dtable);
+		free (map->dblocks);
+		map->dtable = NULL;
+		map->dblocks = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* Frees the memory held by MAP. */
+static void
+map_close (struct inode_map *map) {
+	size_t i;
+
+	if (map->dblocks != NULL)
+		for (i = 0; i < DBLOCK_MAX; i++)
+			free (map->dblocks[i]);
+	free (map->dblocks);
+	free (map->dtable);
+	free (map->indirect);
+	map->dblocks = NULL;
+	map->dtable = NULL;
+	map->indirect = NULL;
+}
+
+/* Sets up MAP for DATA, reading in all of its extent blocks.
+ * Returns false if memory allocation fails. */
+static bool
+map_open (struct inode_map *map, struct inode_disk *data) {
+	size_t i;
+
+	map->hint_idx = map->hint_first = 0;
+	map->dirty_idx = UINT32_MAX;
+	map->indirect = NULL;
+	map->dtable = NULL;
+	map->dblocks = NULL;
+	if (data->indirect != 0) {
+		map->indirect = malloc (DISK_SECTOR_SIZE);
+		if (map->indirect == NULL)
+			goto fail;
+		buffer_cache_read (data->indirect, map->indirect);
+	}
+	if (data->dindirect[0] != 0) {
+		if (!map_alloc_dtable (map))
+			goto fail;
+		for (i = 0; i < DINDIRECT_BLOCKS && data->dindirect[i] != 0; i++)
+			buffer_cache_read (data->dindirect[i],
+					map->dtable + i * DTABLE_ENTRIES);
+		for (i = 0; i < DBLOCK_MAX && map->dtable[i] != 0; i++) {
+			map->dblocks[i] = malloc (DISK_SECTOR_SIZE);
+			if (map->dblocks[i] == NULL)
+				goto fail;
+			buffer_cache_read (map->dtable[i], map->dblocks[i]);
+		}
+	}
+	return true;
+
+fail:
+	map_close (map);
+	return false;
+}
+
+/* Returns the disk sector of file sector SECTOR_OFS.
+ * The walk resumes from the extent found by the previous lookup,
+ * so sequential access costs O(1) per sector no matter how many
+ * extents the file has.  The caller must keep other lookups and
+ * inode_extend() off MAP meanwhile. */
+static disk_sector_t
+map_lookup (struct inode_disk *data, struct inode_map *map,
+		uint32_t sector_ofs) {
+	uint32_t idx = 0, first = 0;
+
+	if (sector_ofs >= map->hint_first) {
+		idx = map->hint_idx;
+		first = map->hint_first;
+	}
+	for (; idx < data->extent_cnt; idx++) {
+		struct extent *e = extent_at (data, map, idx);
+
+		map_step_cnt++;
+		if (sector_ofs < first + e->length) {
+			map->hint_idx = idx;
+			map->hint_first = first;
+			return e->start + (sector_ofs - first);
+		}
+		first += e->length;
+	}
+	NOT_REACHED ();
+}
+
+/* Makes room for one more extent in DATA, allocating the extent
+ * block it goes in, and the doubly indirect block that lists that
+ * extent block, if they do not exist yet. */
+static bool
+reserve_extent (struct inode_disk *data, struct inode_map *map) {
+	int block = extent_block (data->extent_cnt);
+	disk_sector_t *table;
+	struct extent *extents;
+
+	if (block < 0)
+		return true;
+	if (data->extent_cnt >= MAX_EXTENTS)
+		return false;
+	if (block == 0) {
+		if (data->indirect != 0)
+			return true;
+		map->indirect = calloc (INDIRECT_EXTENTS, sizeof *map->indirect);
+		if (map->indirect == NULL)
+			return false;
+		if (!free_map_allocate (1, &data->indirect)) {
+			free (map->indirect);
+			map->indirect = NULL;
+			data->indirect = 0;
+			return false;
+		}
+		return true;
+	}
+
+	block--;
+	if (!map_alloc_dtable (map))
+		return false;
+	if (map->dblocks[block] != NULL)
+		return true;
+	table = &data->dindirect[block / DTABLE_ENTRIES];
+	if (*table == 0 && !free_map_allocate (1, table)) {
+		*table = 0;
+		return false;
+	}
+	extents = calloc (INDIRECT_EXTENTS, sizeof *extents);
+	if (extents == NULL)
+		return false;
+	if (!free_map_allocate (1, &map->dtable[block])) {
+		free (extents);
+		map->dtable[block] = 0;
+		return false;
+	}
+	map->dblocks[block] = extents;
+	return true;
+}
+
+/* Grows the data of DATA to cover LENGTH bytes, zeroing the new
+ * sectors.  The last extent is extended in place when the sectors
+ * after it are free, so a file written sequentially stays in one
+ * extent; otherwise a new extent gets the longest free run that
+ * can be found.
+ * Sectors allocated before a failure stay in the extent list.
+ * Returns true if successful. */
+static bool
+inode_extend (struct inode_disk *data, struct inode_map *map, off_t length) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t want = bytes_to_sectors (length);
+
+	while (data->sector_cnt < want) {
+		size_t need = want - data->sector_cnt;
+		disk_sector_t start = 0;
+		size_t cnt = 0, i;
+
+		if (data->extent_cnt > 0) {
+			struct extent *last = extent_at (data, map,
+					data->extent_cnt - 1);
+			start = last->start + last->length;
+			cnt = free_map_allocate_at (start, need);
+			last->length += cnt;
+			if (cnt > 0 && data->extent_cnt - 1 < map->dirty_idx)
+				map->dirty_idx = data->extent_cnt - 1;
+		}
+		if (cnt == 0) {
+			struct extent *e;
+
+			if (!reserve_extent (data, map))
+				return false;
+			for (cnt = need; cnt > 0; cnt /= 2)
+				if (free_map_allocate (cnt, &start))
+					break;
+			if (cnt == 0)
+				return false;
+			if (data->extent_cnt < map->dirty_idx)
+				map->dirty_idx = data->extent_cnt;
+			e = extent_at (data, map, data->extent_cnt++);
+			e->start = start;
+			e->length = cnt;
+		}
+
+		for (i = 0; i < cnt; i++)
+			buffer_cache_write (start + i, zeros);
+		data->sector_cnt += cnt;
+	}
+	if (length > data->length)
+		data->length = length;
+	return true;
+}
+
+/* Releases every data sector of DATA and its extent blocks. */
+static void
+inode_release (struct inode_disk *data, struct inode_map *map) {
+	uint32_t i;
+
+	for (i = 0; i < data->extent_cnt; i++) {
+		struct extent *e = extent_at (data, map, i);
+		free_map_release (e->start, e->length);
+	}
+	if (data->indirect != 0)
+		free_map_release (data->indirect, 1);
+	for (i = 0; map->dtable != NULL && i < DBLOCK_MAX; i++)
+		if (map->dtable[i] != 0)
+			free_map_release (map->dtable[i], 1);
+	for (i = 0; i < DINDIRECT_BLOCKS; i++)
+		if (data->dindirect[i] != 0)
+			free_map_release (data->dindirect[i], 1);
+}
+
+/* Writes DATA to SECTOR, along with its indirect and doubly
+ * indirect blocks and the extent blocks that changed since the
+ * last write. */
+static void
+inode_write_disk (disk_sector_t sector, struct inode_disk *data,
+		struct inode_map *map) {
+	size_t i;
+
+	if (data->indirect != 0)
+		buffer_cache_write (data->indirect, map->indirect);
+	for (i = 0; i < DINDIRECT_BLOCKS; i++)
+		if (data->dindirect[i] != 0)
+			buffer_cache_write (data->dindirect[i],
+					map->dtable + i * DTABLE_ENTRIES);
+	if (map->dirty_idx < data->extent_cnt) {
+		int first = extent_block (map->dirty_idx);
+		int last = extent_block (data->extent_cnt - 1);
+		int block;
+
+		for (block = first < 1 ? 1 : first; block <= last; block++)
+			buffer_cache_write (map->dtable[block - 1],
+					map->dblocks[block - 1]);
+	}
+	map->dirty_idx = UINT32_MAX;
+	buffer_cache_write (sector, data);
+}
+#endif
+
+static void readahead (struct inode *, off_t start, off_t end);
+static off_t prefetch (struct inode *, off_t offset, off_t size);
+
+/* Most sectors a single read brings into the cache ahead of
+ * copying them out. */
+#define PREFETCH_SECTORS 8
+
+/* Open inodes by sector, so that opening a single inode twice
  * returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Free `struct inode's.  They are carved out of whole pages,
+ * which are kept for reuse rather than given back, so opening and
+ * closing files does not go through malloc each time. */
+static struct list inode_pool;
+#define INODES_PER_PAGE (PGSIZE / sizeof (struct inode))
+
+/* Protects open_inodes, inode_pool and open counts. */
+static struct lock open_inodes_lock;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	open_cmp_cnt++;
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	list_init (&inode_pool);
+	lock_init (&open_inodes_lock);
+}
+
+/* Takes a `struct inode' from the pool, refilling the pool with
+ * a new page if it is empty.  Returns a null pointer if no page
+ * is available.  Must be called with open_inodes_lock held. */
+static struct inode *
+inode_alloc (void) {
+	if (list_empty (&inode_pool)) {
+		struct inode *page = palloc_get_page (0);
+		size_t i;
+
+		if (page == NULL)
+			return NULL;
+		for (i = 0; i < INODES_PER_PAGE; i++)
+			list_push_back (&inode_pool, &page[i].pool_elem);
+	}
+	return list_entry (list_pop_front (&inode_pool), struct inode, pool_elem);
+}
+
+/* Returns INODE to the pool.  Must be called with
+ * open_inodes_lock held. */
+static void
+inode_free (struct inode *inode) {
+	list_push_front (&inode_pool, &inode->pool_elem);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -77,20 +609,16 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
+		struct inode_map map;
+
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+		map_open (&map, disk_inode);
+		if (inode_extend (disk_inode, &map, length)) {
+			inode_write_disk (sector, disk_inode, &map);
 			success = true; 
-		} 
+		} else
+			inode_release (disk_inode, &map);
+		map_close (&map);
 		free (disk_inode);
 	}
 	return success;
@@ -101,39 +629,53 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct hash_elem *e;
 	struct inode *inode;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	lock_acquire (&open_inodes_lock);
+	open_call_cnt++;
 
-	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	/* Check whether this inode is already open. */
+	inode = inode_alloc ();
 	if (inode == NULL)
-		return NULL;
-
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+		goto done;
 	inode->sector = sector;
+	e = hash_find (&open_inodes, &inode->elem);
+	if (e != NULL) {
+		inode_free (inode);
+		inode = hash_entry (e, struct inode, elem);
+		inode->open_cnt++;
+		goto done;
+	}
+
+	/* Initialize.  The lock stays held while the inode is read, so
+	 * that a concurrent open of the same sector waits for it. */
+	hash_insert (&open_inodes, &inode->elem);
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->ra_next = inode->ra_end = 0;
+	lock_init (&inode->map_lock);
+	buffer_cache_read (inode->sector, &inode->data);
+	if (!map_open (&inode->map, &inode->data)) {
+		hash_delete (&open_inodes, &inode->elem);
+		inode_free (inode);
+		inode = NULL;
+	}
+
+done:
+	lock_release (&open_inodes_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -153,19 +695,24 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
+	lock_acquire (&open_inodes_lock);
 	if (--inode->open_cnt == 0) {
 		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+		hash_delete (&open_inodes, &inode->elem);
+		lock_release (&open_inodes_lock);
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			inode_release_sector (inode->sector);
+			inode_release (&inode->data, &inode->map);
 		}
 
-		free (inode); 
+		map_close (&inode->map);
+
+		lock_acquire (&open_inodes_lock);
+		inode_free (inode);
 	}
+	lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -183,7 +730,7 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+	off_t prefetched = offset;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -200,46 +747,110 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		/* A read that spans several sectors, such as paging in part
+		 * of an executable, fetches them with multi-sector disk
+		 * reads instead of one read per sector. */
+		if (offset >= prefetched && size > chunk_size)
+			prefetched = prefetch (inode, offset, size);
+
+		/* Copy the chunk out of the buffer cache. */
+		buffer_cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+				sector_ofs);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+
+	if (bytes_read > 0)
+		readahead (inode, offset - bytes_read, offset);
 
 	return bytes_read;
 }
 
+/* Brings the sectors under bytes [OFFSET, OFFSET + SIZE) of
+ * INODE into the buffer cache, at most PREFETCH_SECTORS of them,
+ * passing each run that is consecutive on disk to the cache as a
+ * whole.  Returns the end of the bytes it covered. */
+static off_t
+prefetch (struct inode *inode, off_t offset, off_t size) {
+	off_t pos = ROUND_DOWN (offset, DISK_SECTOR_SIZE);
+	off_t end = pos + PREFETCH_SECTORS * DISK_SECTOR_SIZE;
+	disk_sector_t first = 0;
+	size_t cnt = 0;
+
+	if (end > offset + size)
+		end = offset + size;
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+
+	for (; pos < end; pos += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, pos);
+		if (cnt > 0 && sector == first + cnt) {
+			cnt++;
+			continue;
+		}
+		if (cnt > 0)
+			buffer_cache_prefetch (first, cnt);
+		first = sector;
+		cnt = 1;
+	}
+	if (cnt > 0)
+		buffer_cache_prefetch (first, cnt);
+	return end;
+}
+
+/* Records a read of bytes [START, END) of INODE.  If it picked up
+ * where the previous read left off, queues the next
+ * READAHEAD_SECTORS sectors past END for the read-ahead daemon. */
+static void
+readahead (struct inode *inode, off_t start, off_t end) {
+	bool sequential = start == inode->ra_next;
+	off_t pos, window_end;
+
+	inode->ra_next = end;
+	if (!sequential) {
+		inode->ra_end = 0;
+		return;
+	}
+
+	/* Only queue the part of the window not already queued. */
+	pos = ROUND_UP (end, DISK_SECTOR_SIZE);
+	if (pos < inode->ra_end)
+		pos = inode->ra_end;
+	window_end = ROUND_UP (end, DISK_SECTOR_SIZE)
+		+ READAHEAD_SECTORS * DISK_SECTOR_SIZE;
+	if (window_end > inode_length (inode))
+		window_end = inode_length (inode);
+	for (; pos < window_end; pos += DISK_SECTOR_SIZE)
+		buffer_cache_readahead (byte_to_sector (inode, pos));
+	if (window_end > inode->ra_end)
+		inode->ra_end = window_end;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full or an error occurs.
+ * A write past end of file extends the inode. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
+	/* Grow the file to cover the write.  If the disk fills up the
+	 * length stays as it was, and the loop below stops at EOF. */
+	lock_acquire (&inode->map_lock);
+	if (offset + size > inode->data.length) {
+		inode_extend (&inode->data, &inode->map, offset + size);
+		inode_write_disk (inode->sector, &inode->data, &inode->map);
+	}
+	lock_release (&inode->map_lock);
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -255,40 +866,22 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* Write the chunk into the buffer cache.  It reaches the
+		 * disk when the sector is evicted or flushed. */
+		buffer_cache_write_at (sector_idx, buffer + bytes_written, chunk_size,
+				sector_ofs);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_written;
 }
 
 /* Disables writes to INODE.
-   May be called at most once per inode opener. */
+ * May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,6 +19,32 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors that one disk command can transfer. */
+#define DISK_MULTI_MAX 256
+
+extern bool disk_use_dma;
+
+/* An asynchronous transfer of CNT consecutive sectors, started
+ * by disk_submit().  The request and its buffer belong to the
+ * disk driver until disk_wait() returns. */
+struct disk_request {
+	struct list_elem elem;      /* Channel queue or merged list element. */
+	struct disk *disk;          /* Disk to transfer to or from. */
+	disk_sector_t sector;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	uint8_t *buffer;            /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                 /* True to write, false to read. */
+	struct semaphore done;      /* Up'd when the transfer completes. */
+
+	/* Requests for the sectors right after this one, moved by
+	 * the same disk command.  Only used while queued. */
+	struct list merged;
+	size_t total_cnt;           /* CNT plus the merged requests' CNTs. */
+
+	int64_t submit_tick;        /* timer_ticks() at submission. */
+	uint64_t submit_tsc;        /* Time-stamp counter at submission. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +52,12 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multi (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multi (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+void disk_submit (struct disk_request *, struct disk *, disk_sector_t,
+		size_t cnt, void *, bool write);
+void disk_wait (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
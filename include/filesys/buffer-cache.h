@@ -0,0 +1,26 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Number of sectors held by the buffer cache. */
+#define BUFFER_CACHE_SIZE 64
+
+/* Number of sectors read ahead of a sequential reader. */
+#define READAHEAD_SECTORS 8
+
+extern unsigned buffer_cache_flush_ms;
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *);
+void buffer_cache_read_at (disk_sector_t, void *, int size, int offset);
+void buffer_cache_write (disk_sector_t, const void *);
+void buffer_cache_write_at (disk_sector_t, const void *, int size, int offset);
+void buffer_cache_readahead (disk_sector_t);
+void buffer_cache_prefetch (disk_sector_t, size_t cnt);
+void buffer_cache_flush (void);
+void buffer_cache_print_stats (void);
+
+#endif /* filesys/buffer-cache.h */
@@ -22,7 +22,7 @@ void fat_init (void);
 void fat_open (void);
 void fat_close (void);
 void fat_create (void);
-void fat_close (void);
+void fat_flush (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
@@ -34,5 +34,26 @@ void fat_remove_chain (
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
+cluster_t sector_to_cluster (disk_sector_t sector);
+
+/* Per-file index into a cluster chain.
+ * Remembers the cluster at every FAT_INDEX_STRIDE-th position of
+ * the chain, plus the last lookup, so that finding the Nth cluster
+ * of a file does not walk the chain from its head every time.
+ * An index is not synchronized: lookups update it, so the owner
+ * must let only one thread at a time use it. */
+#define FAT_INDEX_STRIDE 16
+struct fat_index {
+	cluster_t *marks;     /* marks[i] is cluster #(i * FAT_INDEX_STRIDE). */
+	size_t mark_cnt;      /* Number of known checkpoints. */
+	size_t mark_cap;      /* Allocated size of MARKS. */
+	size_t last_idx;      /* Position of the last lookup. */
+	cluster_t last_clst;  /* Cluster of the last lookup, or 0. */
+	long long hop_cnt;    /* Chain hops taken by lookups, for statistics. */
+};
+
+void fat_index_init (struct fat_index *, cluster_t head);
+void fat_index_destroy (struct fat_index *);
+cluster_t fat_index_lookup (struct fat_index *, size_t idx);
 
 #endif /* filesys/fat.h */
@@ -8,6 +8,8 @@
 struct bitmap;
 
 void inode_init (void);
+bool inode_allocate_sector (disk_sector_t *);
+void inode_release_sector (disk_sector_t);
 bool inode_create (disk_sector_t, off_t);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -19,5 +21,6 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_print_stats (void);
 
 #endif /* filesys/inode.h */
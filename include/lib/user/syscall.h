@@ -78,4 +78,36 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+/* Requests on the file system disk whose latency fell in BUCKET of
+ * the histogram in timer ticks (TSC = 0) or TSC cycles (TSC = 1),
+ * or -1 if there is no such bucket.  Bucket 0 counts latencies of
+ * 0 and bucket I > 0 counts latencies in [2**(I-1), 2**I). */
+static inline long long
+get_fs_disk_latency_cnt (int tsc, int bucket) {
+	long long cnt;
+	asm volatile ("movq $0, %%rdx\n\t"
+			"movq $1, %%rcx\n\t"
+			"int $0x45"
+			: "=a" (cnt)
+			: "S" ((long long) tsc), "D" ((long long) bucket)
+			: "rcx", "rdx", "memory");
+	return cnt;
+}
+
+/* Request queue statistic STAT of the file system disk: 0 requests
+ * completed, 1 sum of the queue depths they saw, 2 maximum queue
+ * depth, 3 bytes read, 4 bytes written.  Returns -1 for any other
+ * STAT. */
+static inline long long
+get_fs_disk_queue_stat (int stat) {
+	long long value;
+	asm volatile ("movq $0, %%rdx\n\t"
+			"movq $1, %%rcx\n\t"
+			"int $0x46"
+			: "=a" (value)
+			: "S" ((long long) stat)
+			: "rcx", "rdx", "memory");
+	return value;
+}
+
 #endif /* lib/user/syscall.h */
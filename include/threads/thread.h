@@ -111,6 +111,7 @@ struct thread {
 	uint8_t padding_2;
 	struct list locks; 
 	struct lock* wanted_lock;
+	int ready_prt;                      /* ready_queues index while THREAD_READY. */
 
 	/* priority scheduling, project 1 */
 	/**********************************/
@@ -119,6 +120,7 @@ struct thread {
 	uint8_t padding_3;
 	int32_t nice; 
 	int32_t recent_cpu;
+	int64_t recent_cpu_epoch;           /* recent_cpu가 반영한 mlfqs epoch. */
 	uint8_t padding_4;
 
 	/* mlfqs scheduling, project 1*/
@@ -199,6 +201,7 @@ void thread_exit_by_error(int error_code);
 void thread_sleep(int64_t ticks);
 
 void thread_wakeup(int64_t ticks);
+int64_t thread_next_wakeup(int64_t limit);
 
 /* alarm clock , project 1 */
 /***************************************************/
@@ -5,9 +5,11 @@ struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t swap_slot; // swap 디스크의 slot 번호, 메모리에 있으면 BITMAP_ERROR
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_swap_dup (struct page *page);
 
 #endif
@@ -7,6 +7,11 @@ struct page;
 enum vm_type;
 
 struct file_page {
+	struct file *file;      // 페이지마다 reopen한 파일
+	off_t offset;           // 파일 오프셋
+	size_t read_bytes;      // 파일에서 읽을 바이트 수
+	size_t zero_bytes;      // 0으로 채울 바이트 수
+	void *mmap_addr;        // 이 페이지가 속한 mmap의 시작 주소, 실행 파일 text 페이지는 NULL
 };
 
 void vm_file_init (void);
@@ -14,4 +19,6 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool file_backed_alloc_text (void *upage, struct file *file, off_t ofs,
+		size_t read_bytes);
 #endif
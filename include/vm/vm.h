@@ -53,6 +53,8 @@ struct page
 	// project 3
 	struct hash_elem hash_elem; // Hash table element
 	bool writable; // 읽기 가능여부
+	struct thread *owner; // 페이지를 소유한 스레드, eviction 시 owner의 pml4에 접근
+	struct list_elem frame_elem; // frame->pages 리스트 element (COW 공유)
 	// void *addr; // Virtual address, 위에 va 사용하면 됨
 
 	/* Per-type data are binded into the union.
@@ -77,6 +79,19 @@ struct frame
 	void *kva;
 	struct page *page;
 	struct hash_elem hash_elem;
+	struct list_elem clock_elem; // clock 리스트 element
+
+	/* copy-on-write: fork 후 부모와 자식이 프레임을 읽기 전용으로 공유 */
+	struct list pages; // 이 프레임에 매핑된 페이지들
+	int ref_cnt;       // pages에 들어있는 페이지 수
+
+	/* 실행 파일 text 공유: 같은 (inode, offset)을 읽는 프로세스끼리 프레임 공유 */
+	struct inode *text_inode;   // text 공유 테이블에 등록된 경우에만 non-NULL
+	off_t text_ofs;             // 파일 오프셋
+	size_t text_read_bytes;     // 파일에서 읽은 바이트 수
+	struct hash_elem text_elem; // text_frames element
+
+	bool evicting;              // swap out I/O 진행중 (frame table에서는 빠져 있음)
 };
 
 /* The function table for page operations.
@@ -112,6 +127,19 @@ struct frame_table {
 	struct hash frames;
 	struct lock hash_lock;
 	int usable_page_cnt;
+
+	/* clock(second-chance) eviction */
+	struct list clock_list;       // 사용중인 프레임, clock 순서
+	struct list_elem *clock_hand; // 다음에 검사할 프레임
+	struct condition evict_done;  // evicting이 풀릴 때마다 broadcast
+
+	struct hash text_frames;      // (inode, offset) -> 읽기 전용 text 프레임
+
+	/* eviction 통계 */
+	long long evict_cnt;          // eviction 횟수
+	long long sweep_cnt;          // clock hand가 지나간 프레임 수 합계
+	size_t max_sweep;             // 한 번의 eviction에서 가장 긴 sweep
+	long long text_share_cnt;     // 디스크 I/O 없이 공유 프레임으로 처리한 fault 수
 };
 
 // project3 Anonymous page - struct for lazy_load_segment
@@ -136,6 +164,9 @@ bool spt_insert_page(struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page(struct supplemental_page_table *spt, struct page *page);
 
 void vm_init(void);
+void vm_print_stats(void);
+void vm_free_frame(struct page *page);
+void vm_wait_evicted(struct page *page);
 bool vm_try_handle_fault(struct intr_frame *f, void *addr, bool user,
 						 bool write, bool not_present);
 
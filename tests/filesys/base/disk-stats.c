@@ -0,0 +1,40 @@
+/* Writes and reads back a small file, then reads one bucket of
+   the file system disk's latency histogram and its count of
+   completed requests through the inspect interrupts, and checks
+   that out-of-range arguments are refused. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 4096
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  long long bucket, requests;
+  int fd;
+
+  CHECK (create ("data", FILE_SIZE), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"data\"");
+  seek (fd, 0);
+  CHECK (read (fd, buf, FILE_SIZE) == FILE_SIZE, "read \"data\"");
+  msg ("close \"data\"");
+  close (fd);
+
+  /* The counters only grow, so a bucket read first cannot exceed
+     the total read after it. */
+  bucket = get_fs_disk_latency_cnt (0, 0);
+  requests = get_fs_disk_queue_stat (0);
+  CHECK (bucket >= 0, "read latency bucket 0");
+  CHECK (requests > 0, "read requests completed");
+  if (bucket > requests)
+    fail ("latency bucket 0 holds %lld requests, more than the %lld "
+          "completed", bucket, requests);
+
+  CHECK (get_fs_disk_latency_cnt (0, 16) == -1,
+         "latency bucket 16 is out of range");
+  CHECK (get_fs_disk_queue_stat (5) == -1, "queue statistic 5 is unknown");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(disk-stats) begin
+(disk-stats) create "data"
+(disk-stats) open "data"
+(disk-stats) write "data"
+(disk-stats) read "data"
+(disk-stats) close "data"
+(disk-stats) read latency bucket 0
+(disk-stats) read requests completed
+(disk-stats) latency bucket 16 is out of range
+(disk-stats) queue statistic 5 is unknown
+(disk-stats) end
+EOF
+pass;
@@ -0,0 +1,109 @@
+/* Grows files of several sizes one block at a time, interleaved
+   with a padding file so that each file ends up in as many
+   extents as it has blocks, then reads random bytes from each
+   and reports how many sectors the disk read per lookup.  An
+   open inode keeps its extent map in memory, so a lookup should
+   cost at most the data sector itself, however large the file
+   and however deep its extent blocks go. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define READ_CNT 500
+
+static const size_t sizes[] = {8 * 1024, 64 * 1024, 512 * 1024, 1024 * 1024};
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+static char block[BLOCK_SIZE];
+
+/* Returns the byte at offset OFS of file IDX. */
+static char
+file_byte (size_t idx, size_t ofs) 
+{
+  return ofs / BLOCK_SIZE * 31 + ofs + idx;
+}
+
+static void
+grow (const char *file_name, int fd, int pad_fd, size_t idx, size_t size) 
+{
+  size_t ofs, i;
+
+  for (ofs = 0; ofs < size; ofs += BLOCK_SIZE) 
+    {
+      for (i = 0; i < BLOCK_SIZE; i++)
+        block[i] = file_byte (idx, ofs + i);
+      if (write (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %d bytes at offset %zu in \"%s\" failed",
+              BLOCK_SIZE, ofs, file_name);
+      if (write (pad_fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %d bytes to \"pad\" failed", BLOCK_SIZE);
+    }
+}
+
+static void
+random_lookups (const char *file_name, size_t idx, size_t size) 
+{
+  long long reads;
+  int fd, i;
+  char c;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  /* Read one byte first, so that faulting in the code below does
+     not show up in the count. */
+  if (read (fd, &c, 1) != 1)
+    fail ("read of byte 0 in \"%s\" failed", file_name);
+
+  reads = get_fs_disk_read_cnt ();
+  for (i = 0; i < READ_CNT; i++) 
+    {
+      size_t ofs = random_ulong () % size;
+
+      seek (fd, ofs);
+      if (read (fd, &c, 1) != 1)
+        fail ("read of byte %zu in \"%s\" failed", ofs, file_name);
+      if (c != file_byte (idx, ofs))
+        fail ("byte %zu in \"%s\" differs", ofs, file_name);
+    }
+  reads = get_fs_disk_read_cnt () - reads;
+
+  msg ("%zu bytes: %lld.%02lld sector reads per lookup", size,
+       reads / READ_CNT, reads * 100 / READ_CNT % 100);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  int fd, pad_fd;
+  size_t i;
+
+  random_init (0);
+
+  CHECK (create ("pad", 0), "create \"pad\"");
+  CHECK ((pad_fd = open ("pad")) > 1, "open \"pad\"");
+  for (i = 0; i < SIZE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "file%zu", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      msg ("grow \"%s\" to %zu bytes", file_name, sizes[i]);
+      grow (file_name, fd, pad_fd, i, sizes[i]);
+      msg ("close \"%s\"", file_name);
+      close (fd);
+    }
+  msg ("close \"pad\"");
+  close (pad_fd);
+
+  for (i = 0; i < SIZE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "file%zu", i);
+      random_lookups (file_name, i, sizes[i]);
+    }
+}
@@ -0,0 +1,53 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Report the sector reads per lookup for each file size, then
+# check the rest of the output without them, since the figures
+# depend on what the buffer cache happens to hold.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($cost) = qr/^\(extent-seek\) (\d+) bytes: (\d+\.\d+) sector reads per lookup$/;
+
+common_checks ("run", @output);
+for (@output) {
+    printf STDOUT "extent-seek: %7d bytes: %s sector reads per lookup\n",
+      $1, $2
+      if /$cost/;
+}
+fail "missing sector reads per lookup\n" if grep (/$cost/, @output) != 4;
+@output = grep (!/$cost/, @output);
+
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(extent-seek) begin
+(extent-seek) create "pad"
+(extent-seek) open "pad"
+(extent-seek) create "file0"
+(extent-seek) open "file0"
+(extent-seek) grow "file0" to 8192 bytes
+(extent-seek) close "file0"
+(extent-seek) create "file1"
+(extent-seek) open "file1"
+(extent-seek) grow "file1" to 65536 bytes
+(extent-seek) close "file1"
+(extent-seek) create "file2"
+(extent-seek) open "file2"
+(extent-seek) grow "file2" to 524288 bytes
+(extent-seek) close "file2"
+(extent-seek) create "file3"
+(extent-seek) open "file3"
+(extent-seek) grow "file3" to 1048576 bytes
+(extent-seek) close "file3"
+(extent-seek) close "pad"
+(extent-seek) open "file0"
+(extent-seek) close "file0"
+(extent-seek) open "file1"
+(extent-seek) close "file1"
+(extent-seek) open "file2"
+(extent-seek) close "file2"
+(extent-seek) open "file3"
+(extent-seek) close "file3"
+(extent-seek) end
+EOF
+pass;
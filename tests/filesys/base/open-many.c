@@ -0,0 +1,68 @@
+/* Creates FILE_CNT files and opens all of them, keeping every one
+   open, then reopens each of them once more and closes everything.
+   Every open after the first round has to find an inode among
+   hundreds that are already open; the inode statistics printed at
+   power off show the open table compares, which should stay at a
+   small constant per open however many files are open. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+#define ROUND_CNT 4
+static int fds[FILE_CNT];
+static int refds[FILE_CNT];
+
+static void
+file_name (char name[16], int i) 
+{
+  snprintf (name, 16, "open%d", i);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int round, i;
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  for (round = 0; round < ROUND_CNT; round++) 
+    {
+      int first = round * FILE_CNT / ROUND_CNT;
+      int last = (round + 1) * FILE_CNT / ROUND_CNT;
+
+      for (i = first; i < last; i++) 
+        {
+          file_name (name, i);
+          fds[i] = open (name);
+          if (fds[i] < 2)
+            fail ("open \"%s\" failed", name);
+        }
+      msg ("%d files open", last);
+    }
+
+  msg ("reopen %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      file_name (name, i);
+      refds[i] = open (name);
+      if (refds[i] < 2)
+        fail ("reopen \"%s\" failed", name);
+    }
+
+  msg ("close %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      close (fds[i]);
+      close (refds[i]);
+    }
+}
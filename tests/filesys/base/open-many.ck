@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-many) begin
+(open-many) create 200 files
+(open-many) 50 files open
+(open-many) 100 files open
+(open-many) 150 files open
+(open-many) 200 files open
+(open-many) reopen 200 files
+(open-many) close 200 files
+(open-many) end
+EOF
+pass;
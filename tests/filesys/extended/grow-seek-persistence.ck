@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($seq) = random_bytes (65536);
+my ($a) = random_bytes (32768);
+my ($b) = random_bytes (32768);
+check_archive ({"seq" => [$seq], "a" => [$a], "b" => [$b]});
+pass;
@@ -0,0 +1,89 @@
+/* Grows one file sequentially and two files in lockstep, so that
+   the first ends up in a single extent and the other two in
+   dozens, then reads random bytes from all three.  The inode
+   statistics printed at power off show what the sector lookups
+   cost. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SEQ_SIZE 65536
+#define FRAG_SIZE 32768
+#define BLOCK_SIZE 512
+#define READ_CNT 1000
+static char buf_seq[SEQ_SIZE];
+static char buf_a[FRAG_SIZE];
+static char buf_b[FRAG_SIZE];
+
+static void
+write_block (const char *file_name, int fd, const char *buf, size_t ofs) 
+{
+  int ret_val = write (fd, buf + ofs, BLOCK_SIZE);
+  if (ret_val != BLOCK_SIZE)
+    fail ("write %d bytes at offset %zu in \"%s\" returned %d",
+          BLOCK_SIZE, ofs, file_name, ret_val);
+}
+
+static void
+random_reads (const char *file_name, const char *buf, size_t size) 
+{
+  int fd;
+  int i;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < READ_CNT; i++) 
+    {
+      size_t ofs = random_ulong () % size;
+      char c;
+
+      seek (fd, ofs);
+      if (read (fd, &c, 1) != 1)
+        fail ("read of byte %zu in \"%s\" failed", ofs, file_name);
+      if (c != buf[ofs])
+        fail ("byte %zu in \"%s\" differs", ofs, file_name);
+    }
+  msg ("%d random reads from \"%s\"", READ_CNT, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int fd, fd_a, fd_b;
+  size_t ofs;
+
+  random_init (0);
+  random_bytes (buf_seq, sizeof buf_seq);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  CHECK (create ("seq", 0), "create \"seq\"");
+  CHECK ((fd = open ("seq")) > 1, "open \"seq\"");
+  msg ("write \"seq\"");
+  for (ofs = 0; ofs < SEQ_SIZE; ofs += BLOCK_SIZE)
+    write_block ("seq", fd, buf_seq, ofs);
+  msg ("close \"seq\"");
+  close (fd);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd_a = open ("a")) > 1, "open \"a\"");
+  CHECK ((fd_b = open ("b")) > 1, "open \"b\"");
+  msg ("write \"a\" and \"b\" alternately");
+  for (ofs = 0; ofs < FRAG_SIZE; ofs += BLOCK_SIZE) 
+    {
+      write_block ("a", fd_a, buf_a, ofs);
+      write_block ("b", fd_b, buf_b, ofs);
+    }
+  msg ("close \"a\"");
+  close (fd_a);
+  msg ("close \"b\"");
+  close (fd_b);
+
+  random_reads ("seq", buf_seq, SEQ_SIZE);
+  random_reads ("a", buf_a, FRAG_SIZE);
+  random_reads ("b", buf_b, FRAG_SIZE);
+}
@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seek) begin
+(grow-seek) create "seq"
+(grow-seek) open "seq"
+(grow-seek) write "seq"
+(grow-seek) close "seq"
+(grow-seek) create "a"
+(grow-seek) create "b"
+(grow-seek) open "a"
+(grow-seek) open "b"
+(grow-seek) write "a" and "b" alternately
+(grow-seek) close "a"
+(grow-seek) close "b"
+(grow-seek) open "seq"
+(grow-seek) 1000 random reads from "seq"
+(grow-seek) close "seq"
+(grow-seek) open "a"
+(grow-seek) 1000 random reads from "a"
+(grow-seek) close "a"
+(grow-seek) open "b"
+(grow-seek) 1000 random reads from "b"
+(grow-seek) close "b"
+(grow-seek) end
+EOF
+pass;
@@ -0,0 +1,78 @@
+/* Puts 1000 threads to sleep at once.  All of them first wake up
+   on the same tick, then each sleeps ITERATIONS more times for
+   durations spread over a few hundred ticks.  Verifies that no
+   thread wakes up early.  The checker reports the longest time
+   the timer interrupt handler ran, with interrupts off, from the
+   kernel's statistics at power-off. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 1000
+#define ITERATIONS 4
+
+/* Information about the test. */
+struct sleep_test
+  {
+    int64_t start;              /* Tick on which all threads wake. */
+    struct semaphore done;      /* Upped by each finished thread. */
+  };
+
+static struct sleep_test test;
+static int ids[THREAD_CNT];
+
+static void sleeper (void *);
+
+void
+test_alarm_stress (void)
+{
+  int i;
+
+  msg ("Creating %d threads to sleep %d times each.",
+       THREAD_CNT, ITERATIONS + 1);
+  msg ("All threads first wake up on the same tick.");
+
+  test.start = timer_ticks () + 200;
+  sema_init (&test.done, 0);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      ids[i] = i;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      thread_create (name, PRI_DEFAULT, sleeper, &ids[i]);
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+  msg ("All %d threads finished.", THREAD_CNT);
+}
+
+/* Sleeps once until TEST.start, then ITERATIONS times for
+   durations that differ from thread to thread. */
+static void
+sleeper (void *id_)
+{
+  int id = *(int *) id_;
+  int i;
+
+  timer_sleep (test.start - timer_ticks ());
+  if (timer_ticks () < test.start)
+    fail ("thread %d woke up before tick %"PRId64, id, test.start);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      int64_t duration = 1 + (id * 37 + i * 101) % 300;
+      int64_t then = timer_ticks ();
+
+      timer_sleep (duration);
+      if (timer_elapsed (then) < duration)
+        fail ("thread %d woke up after %"PRId64" of %"PRId64" ticks",
+              id, timer_elapsed (then), duration);
+    }
+  sema_up (&test.done);
+}
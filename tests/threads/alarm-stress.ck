@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Report the longest and the average time the timer interrupt
+# handler ran, from the statistics the kernel prints at power-off.
+our ($test);
+for (read_text_file ("$test.output")) {
+    printf STDOUT "alarm-stress: timer interrupt ran at most %d cycles"
+      . " (%d on average)\n", $1, $2
+      if /^Timer: interrupt handler ran at most (\d+) cycles, (\d+) on/;
+}
+
+check_expected ([<<'EOF']);
+(alarm-stress) begin
+(alarm-stress) Creating 1000 threads to sleep 5 times each.
+(alarm-stress) All threads first wake up on the same tick.
+(alarm-stress) All 1000 threads finished.
+(alarm-stress) end
+EOF
+pass;
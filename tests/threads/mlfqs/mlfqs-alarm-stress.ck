@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# alarm-stress under the MLFQS, whose once-a-second recent_cpu
+# update must not visit the 1000 sleeping threads.  Report the
+# longest and the average time the timer interrupt handler ran,
+# from the statistics the kernel prints at power-off.
+our ($test);
+for (read_text_file ("$test.output")) {
+    printf STDOUT "mlfqs-alarm-stress: timer interrupt ran at most %d cycles"
+      . " (%d on average)\n", $1, $2
+      if /^Timer: interrupt handler ran at most (\d+) cycles, (\d+) on/;
+}
+
+check_expected ([<<'EOF']);
+(mlfqs-alarm-stress) begin
+(mlfqs-alarm-stress) Creating 1000 threads to sleep 5 times each.
+(mlfqs-alarm-stress) All threads first wake up on the same tick.
+(mlfqs-alarm-stress) All 1000 threads finished.
+(mlfqs-alarm-stress) end
+EOF
+pass;
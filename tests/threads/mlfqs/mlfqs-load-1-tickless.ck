@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# mlfqs-load-1 with -tickless: the load average must still decay
+# over the 10 idle seconds, during which the timer should mostly
+# have been stopped.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my ($skipped) = map (/^Timer: (\d+) ticks skipped while idle/, @output);
+fail "no ticks were skipped while idle\n"
+  if !defined ($skipped) || $skipped == 0;
+
+@output = get_core_output ("run", @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(mlfqs-load-1-tickless) PASS', @output);
+
+pass;
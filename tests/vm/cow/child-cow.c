@@ -0,0 +1,8 @@
+/* Child process run by cow-fork-exec.  Does nothing but exit, so
+   the cost measured by the parent is that of fork and exec. */
+
+int
+main (void)
+{
+	return 0;
+}
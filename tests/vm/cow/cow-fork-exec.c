@@ -0,0 +1,67 @@
+/* Forks and execs many children from a parent with a large
+   resident address space.  With copy-on-write fork the children
+   only share the parent's frames until exec replaces them, so the
+   whole run should cost a handful of page faults per child instead
+   of a full copy of the parent.  Reports the average cost of a
+   fork, and of a whole fork, exec and wait round, in TSC cycles;
+   the checker passes the figures on without judging them. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK_SIZE (2 * 1024 * 1024)
+#define CHILD_CNT 32
+
+static char buf[CHUNK_SIZE];
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+	void *pa_parent;
+	size_t i;
+	int child_cnt;
+	uint64_t start, fork_cycles = 0, total_cycles;
+
+	for (i = 0; i < CHUNK_SIZE; i += 4096)
+		buf[i] = (char) (i >> 12);
+	msg ("touched parent pages");
+	pa_parent = get_phys_addr (buf);
+
+	start = rdtsc ();
+	for (child_cnt = 0; child_cnt < CHILD_CNT; child_cnt++) {
+		uint64_t before = rdtsc ();
+		pid_t child = fork ("child-cow");
+		if (child == 0) {
+			if (get_phys_addr (buf) != pa_parent)
+				fail ("child %d does not share parent's frame", child_cnt);
+			exec ("child-cow");
+			fail ("exec failed");
+		}
+		fork_cycles += rdtsc () - before;
+		if (wait (child) != 0)
+			fail ("child %d failed", child_cnt);
+	}
+	total_cycles = rdtsc () - start;
+	msg ("forked and exec'd %d children", CHILD_CNT);
+	msg ("%llu cycles per fork, %llu per fork, exec and wait",
+	     (unsigned long long) (fork_cycles / CHILD_CNT),
+	     (unsigned long long) (total_cycles / CHILD_CNT));
+
+	for (i = 0; i < CHUNK_SIZE; i += 4096)
+		if (buf[i] != (char) (i >> 12))
+			fail ("parent data changed at offset %zu", i);
+	msg ("check parent data");
+}
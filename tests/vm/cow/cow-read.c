@@ -0,0 +1,43 @@
+/* Forks a child that read()s a file into a buffer it still shares
+   with its parent by copy-on-write.  The kernel's write into the
+   buffer must land in a copy of the child's own, leaving the
+   parent's data as it was. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/sample.inc"
+
+static char buf[sizeof sample];
+
+void
+test_main (void)
+{
+	pid_t child;
+	void *pa_parent;
+	size_t i;
+
+	memset (buf, 'P', sizeof buf);
+	pa_parent = get_phys_addr (buf);
+
+	child = fork ("child");
+	if (child == 0) {
+		int handle;
+
+		CHECK (get_phys_addr (buf) == pa_parent, "child shares parent's buffer");
+		CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+		CHECK (read (handle, buf, sizeof sample - 1) == (int) sizeof sample - 1,
+		       "read \"sample.txt\" into shared buffer");
+		CHECK (memcmp (buf, sample, sizeof sample - 1) == 0, "check child's data");
+		exit (0);
+	}
+	CHECK (wait (child) == 0, "wait for child");
+
+	for (i = 0; i < sizeof buf; i++)
+		if (buf[i] != 'P')
+			fail ("parent's buffer changed at offset %zu", i);
+	CHECK (get_phys_addr (buf) == pa_parent, "parent kept its frame");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-read) begin
+(cow-read) child shares parent's buffer
+(cow-read) open "sample.txt"
+(cow-read) read "sample.txt" into shared buffer
+(cow-read) check child's data
+(cow-read) wait for child
+(cow-read) parent kept its frame
+(cow-read) end
+EOF
+pass;
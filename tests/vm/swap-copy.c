@@ -0,0 +1,110 @@
+/* Runs a swap-heavy process and a file-copy process side by
+   side.  Swap goes to hd1:1 and files to hd0:1, so the two
+   should overlap rather than wait for each other.  The checker
+   reports the combined disk throughput from the kernel's
+   statistics at power-off. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SWAP_SIZE (8 * 1024 * 1024)     /* Anonymous memory to churn. */
+#define SWAP_PASSES 2
+#define COPY_SIZE (256 * 1024)          /* Size of the copied file. */
+#define COPY_ROUNDS 4
+
+static char swap_buf[SWAP_SIZE];
+static char copy_buf[PAGE_SIZE];
+static char check_buf[PAGE_SIZE];
+
+/* Touches every page of swap_buf SWAP_PASSES times, checking
+   each time what the last pass left there. */
+static void
+swapper (void)
+{
+  size_t pass, i;
+
+  for (pass = 0; pass < SWAP_PASSES; pass++)
+    for (i = 0; i < SWAP_SIZE; i += PAGE_SIZE)
+      {
+        if (pass > 0 && swap_buf[i] != (char) (i / PAGE_SIZE + pass - 1))
+          fail ("swapped page %zu is inconsistent", i / PAGE_SIZE);
+        swap_buf[i] = (char) (i / PAGE_SIZE + pass);
+      }
+  exit (81);
+}
+
+/* Copies "src" to "dst" COPY_ROUNDS times, one page at a time,
+   and then checks "dst" against the data "src" was made from. */
+static void
+copier (void)
+{
+  struct arc4 arc4;
+  int src, dst;
+  size_t round, ofs;
+
+  CHECK ((src = open ("src")) > 1, "open \"src\"");
+  CHECK ((dst = open ("dst")) > 1, "open \"dst\"");
+  for (round = 0; round < COPY_ROUNDS; round++)
+    {
+      seek (src, 0);
+      seek (dst, 0);
+      for (ofs = 0; ofs < COPY_SIZE; ofs += PAGE_SIZE)
+        {
+          if (read (src, copy_buf, PAGE_SIZE) != PAGE_SIZE)
+            fail ("read \"src\" at %zu failed", ofs);
+          if (write (dst, copy_buf, PAGE_SIZE) != PAGE_SIZE)
+            fail ("write \"dst\" at %zu failed", ofs);
+        }
+    }
+
+  arc4_init (&arc4, "swap-copy", 9);
+  seek (dst, 0);
+  for (ofs = 0; ofs < COPY_SIZE; ofs += PAGE_SIZE)
+    {
+      memset (check_buf, 0, PAGE_SIZE);
+      arc4_crypt (&arc4, check_buf, PAGE_SIZE);
+      if (read (dst, copy_buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("read \"dst\" at %zu failed", ofs);
+      compare_bytes (copy_buf, check_buf, PAGE_SIZE, ofs, "dst");
+    }
+  exit (82);
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  pid_t swap_pid, copy_pid;
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((fd = open ("src")) > 1, "open \"src\"");
+  arc4_init (&arc4, "swap-copy", 9);
+  for (ofs = 0; ofs < COPY_SIZE; ofs += PAGE_SIZE)
+    {
+      memset (copy_buf, 0, PAGE_SIZE);
+      arc4_crypt (&arc4, copy_buf, PAGE_SIZE);
+      if (write (fd, copy_buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("write \"src\" at %zu failed", ofs);
+    }
+  close (fd);
+
+  msg ("start swapper and copier");
+  quiet = true;
+  if ((swap_pid = fork ("swapper")) == 0)
+    swapper ();
+  if ((copy_pid = fork ("copier")) == 0)
+    copier ();
+  quiet = false;
+
+  CHECK (wait (swap_pid) == 81, "wait for swapper");
+  CHECK (wait (copy_pid) == 82, "wait for copier");
+  msg ("swapped %d kB, copied %d kB",
+       SWAP_SIZE / 1024 * SWAP_PASSES, COPY_SIZE / 1024 * COPY_ROUNDS);
+}
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Report the combined throughput of the file system and swap
+# disks, from the statistics the kernel prints at power-off.
+our ($test);
+my ($ticks, $sectors) = (0, 0);
+for (read_text_file ("$test.output")) {
+    $ticks = $1 if /^Timer: (\d+) ticks/;
+    $sectors += $2 + $3 if /^(hd0:1|hd1:1): (\d+) reads, (\d+) writes/;
+}
+printf STDOUT "swap-copy: %d kB moved on hd0:1 and hd1:1 in %d ticks"
+  . " (%d kB/s)\n", $sectors / 2, $ticks,
+  $ticks ? $sectors / 2 * 100 / $ticks : 0;
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-copy) begin
+(swap-copy) create "src"
+(swap-copy) create "dst"
+(swap-copy) open "src"
+(swap-copy) start swapper and copier
+(swap-copy) wait for swapper
+(swap-copy) wait for copier
+(swap-copy) swapped 16384 kB, copied 1024 kB
+(swap-copy) end
+EOF
+pass;
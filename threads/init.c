@@ -36,6 +36,9 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/buffer-cache.h"
+#include "filesys/inode.h"
+#include "filesys/directory.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -216,11 +219,17 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+		else if (!strcmp (name, "-wb"))
+			buffer_cache_flush_ms = atoi (value);
+		else if (!strcmp (name, "-dma"))
+			disk_use_dma = true;
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -326,6 +335,11 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -tickless          Stop the timer interrupt while idle.\n"
+#ifdef FILESYS
+			"  -wb=MS             Write back dirty cached sectors every MS msecs.\n"
+			"  -dma               Use bus-master DMA for disk transfers.\n"
+#endif
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -356,6 +370,12 @@ print_stats (void) {
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	buffer_cache_print_stats ();
+	inode_print_stats ();
+	dir_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
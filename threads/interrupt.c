@@ -259,6 +259,23 @@ intr_context (void) {
 	return in_external_intr;
 }
 
+/* Returns true if the PICs have latched external interrupt VEC_NO
+   but have not yet delivered it to the CPU, as happens while
+   interrupts are off. */
+bool
+intr_pending (uint8_t vec_no) {
+	int irq = vec_no - 0x20;
+
+	ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+	if (irq < 8) {
+		outb (0x20, 0x0a);  /* OCW3: read IRR. */
+		return (inb (0x20) & (1 << irq)) != 0;
+	} else {
+		outb (0xa0, 0x0a);  /* OCW3: read IRR. */
+		return (inb (0xa0) & (1 << (irq - 8))) != 0;
+	}
+}
+
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
    returning from the interrupt.  May not be called at any other
@@ -344,6 +361,11 @@ intr_handler (struct intr_frame *frame) {
 
 		in_external_intr = true;
 		yield_on_return = false;
+
+		/* If the timer was stopped while idle, catch up on the
+		   ticks missed so far before the handler looks at them. */
+		if (frame->vec_no != 0x20)
+			timer_idle_exit ();
 	}
 
 	/* Invoke the interrupt's handler. */
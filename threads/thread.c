@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -26,9 +27,17 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO
+   queue per priority, and bit P of ready_bitmap is set whenever
+   ready_queues[P] is nonempty, so the highest-priority ready
+   thread is found with one bit scan. */
+#if PRI_MAX >= 64
+#error ready_bitmap needs one bit per priority
+#endif
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static size_t ready_cnt;        /* Number of threads in ready_queues. */
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -51,34 +60,56 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 /**********************************************/
 /* alarm clock, project 1 */
 
-static struct list waiting_list;
-static bool
-sort_by_sleeptime_asc (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED);
+/* 잠든 스레드는 계층형 timer wheel에 둔다. level L의 한 칸은 
+   2^(WHEEL_BITS*L) tick 폭이고, 깰 시각이 가까워지면 아래 level로 
+   옮겨진다(cascade). 넣기는 O(1), tick마다 하는 일은 깨울 스레드 수에 
+   비례한다. (옮기는 비용은 스레드마다 최대 WHEEL_LEVELS번) */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN(level) ((int64_t) 1 << (WHEEL_BITS * (level)))
+
+static struct list sleep_wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t sleep_bitmap[WHEEL_LEVELS];   /* 비어있지 않은 칸 */
+static int64_t wheel_next;                    /* 다음에 처리할 tick */
+static int sleep_cnt;
+
+static void wheel_insert (struct thread *t);
+static void wheel_cascade (int level, int64_t tick);
 
 /* alarm clock, project 1 */
 /**********************************************/
 /* priority scheduling, project 1 */
 
-static bool
-sort_by_prt_desc (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED) ;
 static bool 
 is_priority_less_than_next(int64_t p);
-#define thread_entry(list_elem) (list_entry(list_elem, struct thread, elem))
-#define insert_ready(elem) (list_insert_ordered(&ready_list, &(elem), sort_by_prt_desc,NULL))
+static void ready_push (struct thread *t);
+static struct thread *ready_pop (void);
+static void ready_remove (struct thread *t);
+static int ready_max_prt (void);
 
 /* priority scheduling, project 1 */
 /**********************************************/
 /* advanced scheduling, project 1 */
-typedef void calculation(struct thread* t);
 
 static ffloat load_avg; 		
 static struct list mlfqs_all_thread;
 
+/* recent_cpu는 매초 모든 스레드에서 감쇠되지만, ready가 아닌 스레드는 
+   다시 ready가 될 때 한꺼번에 따라잡는다. 그러려고 초(epoch)마다 쓴 
+   감쇠 계수를 최근 DECAY_HISTORY개만 남겨 둔다. */
+#define DECAY_HISTORY 64
+static ffloat decay_hist[DECAY_HISTORY];   /* epoch e -> e+1 계수, e % DECAY_HISTORY 자리 */
+static int64_t mlfqs_epoch;                /* 지금까지 지난 초 */
+
+/* 기록보다 오래된 감쇠를 한 번에 계산할 때 쓰는 정밀도 */
+#define DECAY_SHIFT 30
+#define DECAY_ONE ((int64_t) 1 << DECAY_SHIFT)
+
 static void mlfqs_reset_prt(void);
 static void mlfqs_task(void);
 // static void mlfqs_recalibrate(struct list * l);
 
-static void linear_traversal(struct list* l, calculation* func);
 static void mlfqs_set_load_avg(void);
 static void mlfqs_set_priority(struct thread* t);
 static void mlfqs_set_recent_cpu(struct thread* t);
@@ -148,11 +179,20 @@ thread_init (void) {
 
 	/* Init the globla thread context */
 	lock_init (&tid_lock);
-	list_init (&ready_list);
+	for (int i = PRI_MIN; i <= PRI_MAX; i++)
+		list_init (&ready_queues[i]);
+	ready_bitmap = 0;
+	ready_cnt = 0;
 	list_init (&destruction_req);
 	
 	/* custum init part  */
-	list_init(&waiting_list);
+	for (int i = 0; i < WHEEL_LEVELS; i++) {
+		for (int j = 0; j < WHEEL_SIZE; j++)
+			list_init (&sleep_wheel[i][j]);
+		sleep_bitmap[i] = 0;
+	}
+	wheel_next = 1;
+	sleep_cnt = 0;
 	
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -275,6 +315,7 @@ thread_create (const char *name, int priority,
 	if(thread_mlfqs){
 		t->nice = thread_get_nice(); // 상속
 		t->recent_cpu = thread_current()->recent_cpu;
+		t->recent_cpu_epoch = mlfqs_epoch;
 	}
 #ifdef USERPROG
 	struct thread *curr;
@@ -340,7 +381,7 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	insert_ready(t->elem);
+	ready_push(t);
 	t->status = THREAD_READY;
 	intr_set_level (old_level);
 }
@@ -430,7 +471,7 @@ thread_yield (void) {
 
 	old_level = intr_disable ();
 	if (curr != idle_thread)
-		insert_ready(curr->elem);
+		ready_push(curr);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
@@ -454,8 +495,15 @@ thread_get_priority (void) {
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice UNUSED) {
-	/* TODO: Your implementation goes here */
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
 	thread_current()->nice = nice;
+	if(thread_mlfqs)
+		mlfqs_set_priority(thread_current());
+	intr_set_level (old_level);
+	if(is_priority_less_than_next(thread_get_priority()))
+		thread_yield();
 }
 
 /* Returns the current thread's nice value. */
@@ -511,7 +559,12 @@ idle (void *idle_started_ UNUSED) {
 		   time.
 
 		   See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-		   7.11.1 "HLT Instruction". */
+		   7.11.1 "HLT Instruction".
+
+		   With -tickless, timer_idle_enter() first stops the
+		   periodic timer interrupt until some thread is due to
+		   wake. */
+		timer_idle_enter ();
 		asm volatile ("sti; hlt" : : : "memory");
 	}
 }
@@ -559,10 +612,10 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
+	if (ready_bitmap == 0)
 		return idle_thread;
 	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+		return ready_pop ();
 }
 
 /* Use iretq to launch the thread */
@@ -750,26 +803,114 @@ thread_sleep(int64_t ticks)
 
 	old_level = intr_disable ();
 	curr->sleep_time = ticks;
-	list_insert_ordered(&waiting_list,&(curr->elem),sort_by_sleeptime_asc,NULL);
+	wheel_insert(curr);
+	sleep_cnt++;
 	thread_block();
 	intr_set_level (old_level);
 }
 
 
+/* TICKS까지의 tick을 차례로 처리하며 깰 시각이 된 스레드를 깨운다.
+   timer interrupt에서 불린다. */
 void 
 thread_wakeup(int64_t ticks)
 {
-	while(!list_empty(&waiting_list) && (list_entry(list_front(&waiting_list), struct thread, elem))->sleep_time <= ticks )
-		thread_unblock(list_entry(list_pop_front(&waiting_list),struct thread, elem));
-	
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	/* 잠든 스레드가 없으면 wheel을 바로 TICKS 다음으로 옮긴다. */
+	if(sleep_cnt == 0)
+	{
+		wheel_next = ticks + 1;
+		return;
+	}
+
+	for(; wheel_next <= ticks; wheel_next++)
+	{
+		struct list *slot;
+
+		/* 위 level부터 이번 tick에 시작하는 칸을 아래로 내린다. */
+		for(int level = WHEEL_LEVELS - 1; level > 0; level--)
+			if(wheel_next % WHEEL_SPAN(level) == 0)
+				wheel_cascade(level, wheel_next);
+
+		slot = &sleep_wheel[0][wheel_next & (WHEEL_SIZE - 1)];
+		sleep_bitmap[0] &= ~(1ULL << (wheel_next & (WHEEL_SIZE - 1)));
+		while(!list_empty(slot))
+		{
+			struct thread *t = list_entry(list_pop_front(slot), struct thread, elem);
+
+			ASSERT(t->sleep_time <= wheel_next);
+			sleep_cnt--;
+			thread_unblock(t);
+		}
+	}
 }
 
-static bool
-sort_by_sleeptime_asc(const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED) 
+
+/* LIMIT 이전에 thread_wakeup이 할 일(깨우기나 cascade)이 있는 
+   가장 이른 tick. 없으면 LIMIT. 다음 tick부터 보며, LIMIT은 
+   WHEEL_SIZE tick 안이어야 한다. */
+int64_t
+thread_next_wakeup(int64_t limit)
 {
-  const struct thread *a = list_entry (a_, struct thread, elem);
-  const struct thread *b = list_entry (b_, struct thread, elem);
-  return a->sleep_time < b-> sleep_time;
+	int64_t t;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+	ASSERT(limit - wheel_next <= WHEEL_SIZE);
+
+	if(sleep_cnt == 0)
+		return limit;
+	for(t = wheel_next; t < limit; t++)
+		if((sleep_bitmap[0] & (1ULL << (t & (WHEEL_SIZE - 1)))) 
+				|| t % WHEEL_SPAN(1) == 0)
+			return t;
+	return limit;
+}
+
+
+/* 잠든 T를 sleep_time에 맞는 wheel 칸에 넣는다. wheel_next 기준으로 
+   WHEEL_SPAN(L+1) tick 안에 깰 스레드는 level L 이하에 들어간다. */
+static void
+wheel_insert (struct thread *t)
+{
+	int64_t when = t->sleep_time > wheel_next ? t->sleep_time : wheel_next;
+	int64_t delta = when - wheel_next;
+	int level = 0, slot;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	while(level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level + 1))
+		level++;
+
+	/* wheel 범위 밖이면 맨 위 level의 가장 먼 칸에 두고, 
+	   그 칸이 내려올 때 다시 넣는다. */
+	if(delta >= WHEEL_SPAN(WHEEL_LEVELS))
+		when = wheel_next + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+
+	slot = (when >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+	list_push_back(&sleep_wheel[level][slot], &t->elem);
+	sleep_bitmap[level] |= 1ULL << slot;
+}
+
+
+/* TICK에 시작하는 level LEVEL의 칸에 있는 스레드를 다시 넣는다. 
+   모두 WHEEL_SPAN(LEVEL) tick 안에 깨므로 아래 level로 간다. */
+static void
+wheel_cascade (int level, int64_t tick)
+{
+	int slot = (tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+	struct list moved;
+
+	if(!(sleep_bitmap[level] & (1ULL << slot)))
+		return;
+
+	list_init(&moved);
+	while(!list_empty(&sleep_wheel[level][slot]))
+		list_push_back(&moved, list_pop_front(&sleep_wheel[level][slot]));
+	sleep_bitmap[level] &= ~(1ULL << slot);
+
+	while(!list_empty(&moved))
+		wheel_insert(list_entry(list_pop_front(&moved), struct thread, elem));
 }
 
 
@@ -795,6 +936,13 @@ thread_try_donate_prt(int given_prt, struct thread* to)
 			return false;
 		set_donated_prt(to,given_prt);
 	}
+
+	// ready 상태면 올라간 우선순위의 queue로 옮겨야 다음 스케줄링에 반영됨
+	if(to->status == THREAD_READY && to->ready_prt != given_prt)
+	{
+		ready_remove(to);
+		ready_push(to);
+	}
 	return true;
 }
 
@@ -822,24 +970,79 @@ thread_get_priority_any(const struct thread* t)
 
 
 /* Compare 'p'(p should be priority of some thread) 
-   with ready_list thread. */
+   with the highest-priority ready thread. */
 static bool 
 is_priority_less_than_next(int64_t p)
 {
-	if(list_empty(&ready_list))
-		return false;
-	struct thread *front = thread_entry(list_front(&ready_list));
-	return (p < thread_get_priority_any(front));
+	return (p < ready_max_prt());
 }
 
 
-// Todo 이후에 bit mask 추가해서 insert_by_prt 와 통합
-static bool
-sort_by_prt_desc (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED) 
+/* T를 현재 (기부 포함) 우선순위의 queue 맨 뒤에 넣는다. 
+   같은 우선순위끼리는 들어온 순서대로 실행됨. */
+static void
+ready_push (struct thread *t)
 {
-  const struct thread *a = list_entry (a_, struct thread, elem);
-  const struct thread *b = list_entry (b_, struct thread, elem);
-  return thread_get_priority_any(a) > thread_get_priority_any(b);
+	int prt;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	/* mlfqs: 밀린 감쇠를 반영하고 우선순위를 다시 계산한다. 
+	   ready 스레드의 우선순위는 늘 최신이어야 하기 때문. */
+	if(thread_mlfqs)
+	{
+		mlfqs_set_recent_cpu(t);
+		mlfqs_set_priority(t);
+	}
+	prt = thread_get_priority_any(t);
+	ASSERT(PRI_MIN <= prt && prt <= PRI_MAX);
+
+	t->ready_prt = prt;
+	list_push_back(&ready_queues[prt], &t->elem);
+	ready_bitmap |= 1ULL << prt;
+	ready_cnt++;
+}
+
+
+/* 가장 높은 우선순위 queue의 맨 앞 스레드를 꺼낸다. */
+static struct thread *
+ready_pop (void)
+{
+	int prt = ready_max_prt();
+	struct thread *t;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+	ASSERT(prt >= PRI_MIN);
+
+	t = list_entry(list_pop_front(&ready_queues[prt]), struct thread, elem);
+	if(list_empty(&ready_queues[prt]))
+		ready_bitmap &= ~(1ULL << prt);
+	ready_cnt--;
+	return t;
+}
+
+
+/* ready 상태인 T를 queue에서 뺀다. */
+static void
+ready_remove (struct thread *t)
+{
+	ASSERT(intr_get_level() == INTR_OFF);
+	ASSERT(t->status == THREAD_READY);
+
+	list_remove(&t->elem);
+	if(list_empty(&ready_queues[t->ready_prt]))
+		ready_bitmap &= ~(1ULL << t->ready_prt);
+	ready_cnt--;
+}
+
+
+/* ready 스레드 중 가장 높은 우선순위. 없으면 -1. */
+static int
+ready_max_prt (void)
+{
+	if(ready_bitmap == 0)
+		return -1;
+	return 63 - __builtin_clzll(ready_bitmap);
 }
 
 
@@ -849,39 +1052,45 @@ sort_by_prt_desc (const struct list_elem *a_, const struct list_elem *b_, void *
 
 
 
+/* time slice마다 불린다. 지난 slice 동안 recent_cpu가 바뀐 건 실행 중인 
+   스레드뿐이고, ready 스레드는 ready_push와 mlfqs_task에서 이미 
+   계산되어 있다. */
 static void 
 mlfqs_reset_prt(void)
 {	
 	mlfqs_set_priority(thread_current());
-	linear_traversal(&ready_list, mlfqs_set_priority);
-	linear_traversal(&waiting_list, mlfqs_set_priority);
-	list_sort(&ready_list, sort_by_prt_desc, NULL);
 }
 
 
 
+/* 1초마다 불린다. load_avg와 이번 초의 감쇠 계수를 구하고, 
+   recent_cpu가 바뀐 실행 중인 스레드와 ready 스레드만 다시 계산한다. 
+   잠들거나 block된 스레드는 ready_push에서 따라잡는다. */
 static void 
 mlfqs_task(void)
 {	
+	struct list moved;
+
 	mlfqs_set_load_avg();
-	mlfqs_set_recent_cpu(thread_current());
-	linear_traversal(&ready_list, mlfqs_set_recent_cpu);
-	linear_traversal(&waiting_list, mlfqs_set_recent_cpu);
-}
 
+	/* recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice */
+	decay_hist[mlfqs_epoch % DECAY_HISTORY] = 
+		div_ff(mul_fi(load_avg,2), add_fi(mul_fi(load_avg,2),1));
+	mlfqs_epoch++;
 
-static void 
-linear_traversal(struct list* l, calculation* func)
-{	
-	struct thread * t;
-	if(!list_empty(l)){
-		t = list_entry(list_front(l), struct thread, elem);
-		while(is_thread(t))
-		{	
-			func(t);
-			t = list_entry(list_next(&t->elem),struct thread, elem);
-		}
+	mlfqs_set_recent_cpu(thread_current());
+	mlfqs_set_priority(thread_current());
+
+	/* 높은 queue부터 앞에서부터 꺼내 다시 넣는다(ready_push가 계산). 
+	   같은 우선순위끼리는 순서가 유지된다. */
+	list_init(&moved);
+	while(ready_bitmap != 0)
+	{
+		struct thread *t = ready_pop();
+		list_push_back(&moved, &t->elem);
 	}
+	while(!list_empty(&moved))
+		ready_push(list_entry(list_pop_front(&moved), struct thread, elem));
 }
 
 
@@ -897,20 +1106,58 @@ mlfqs_set_load_avg(void)
 	f59 = convert_if(59);
 	f60 = convert_if(60);
 
-	size = (idle_thread == thread_current()) ? list_size(&ready_list) : list_size(&ready_list)+1;
+	size = (idle_thread == thread_current()) ? ready_cnt : ready_cnt+1;
 
 	/* load_avg = (59/60) * load_avg + (1/60) * ready_threads */
 	load_avg = add_ff(mul_ff( div_ff(f59,f60), load_avg ),mul_fi( div_ff(f1,f60), size));
 }
 
 
+/* 고정소수점 계수 COEF를 K번 곱한 값을 DECAY_ONE 단위로 구한다. 
+   제곱을 거듭하므로 K가 커도 O(log K)번만 곱하고, fbase보다 정밀한 
+   단위를 써서 곱할 때마다 버려지는 자리가 결과를 흐리지 않게 한다. */
+static int64_t
+decay_pow(ffloat coef, int64_t k)
+{
+	int64_t base = (int64_t) coef * (DECAY_ONE / fbase);
+	int64_t pow = DECAY_ONE;
+
+	for(; k > 0 && pow != 0; k >>= 1)
+	{
+		if(k & 1)
+			pow = pow * base >> DECAY_SHIFT;
+		base = base * base >> DECAY_SHIFT;
+	}
+	return pow;
+}
+
+
 static void 
 mlfqs_set_recent_cpu(struct thread* t)
 {
+	int64_t oldest = mlfqs_epoch - DECAY_HISTORY;
+
 	ASSERT(intr_get_level() == INTR_OFF);
 
-	/* recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice */
-	t->recent_cpu = add_fi(mul_ff( div_ff(mul_fi(load_avg,2), add_fi(mul_fi(load_avg,2),1)), t->recent_cpu), t->nice);
+	/* 기록이 남지 않은 오래된 k초는 가장 오래된 계수 c로 대신하므로 
+	   결과가 매초 계산한 값과 다를 수 있다. 같은 c를 k번 적용한 결과 
+	   c^k * recent_cpu + nice * (1 - c^k) / (1 - c)를 바로 구해서, 
+	   오래 잠든 스레드도 타이머 인터럽트 안에서 초마다 돌지 않게 한다. */
+	if(t->recent_cpu_epoch < oldest)
+	{
+		ffloat coef = decay_hist[oldest % DECAY_HISTORY];
+		int64_t pow = decay_pow(coef, oldest - t->recent_cpu_epoch);
+
+		t->recent_cpu = ((int64_t) t->recent_cpu * pow >> DECAY_SHIFT)
+			+ (int64_t) t->nice * fbase * (DECAY_ONE - pow) 
+			/ ((int64_t) (fbase - coef) * (DECAY_ONE / fbase));
+		t->recent_cpu_epoch = oldest;
+	}
+
+	/* 최근 DECAY_HISTORY초는 그 초의 계수를 순서대로 적용한다. */
+	for(; t->recent_cpu_epoch < mlfqs_epoch; t->recent_cpu_epoch++)
+		t->recent_cpu = add_fi(mul_ff(decay_hist[t->recent_cpu_epoch % DECAY_HISTORY], 
+				t->recent_cpu), t->nice);
 }
 
 
@@ -902,8 +902,7 @@ lazy_load_segment (struct page *page, void *aux) {
 
 	// 피일에서 페이지 데이터 로드
 	if(file_read(info->file, page->frame->kva, info->page_read_bytes) != (int) info->page_read_bytes) {
-		palloc_free_page(page->frame->kva); // 실패시 페이지 메모리 해제
-		return false;
+		return false; // 실패시 프레임은 vm_do_claim_page에서 해제
 	}
 	memset(page->frame->kva + info->page_read_bytes, 0, info->page_zero_bytes);
 	
@@ -938,20 +937,26 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		struct load_info *aux = malloc(sizeof(struct load_info));
-		struct load_info load_info = {
-				.file = file,
-				.offset = ofs,
-				.page_read_bytes = page_read_bytes,
-				.page_zero_bytes = page_zero_bytes,
-				.writable = writable
-		};
-
-		memcpy(aux, &load_info, sizeof(struct load_info));
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		// 읽기 전용 세그먼트는 다른 프로세스와 프레임을 공유할 수 있는 file 페이지로 등록
+		if (!writable) {
+			if (!file_backed_alloc_text (upage, file, ofs, page_read_bytes))
+				return false;
+		} else {
+			/* TODO: Set up aux to pass information to the lazy_load_segment. */
+			struct load_info *aux = malloc(sizeof(struct load_info));
+			struct load_info load_info = {
+					.file = file,
+					.offset = ofs,
+					.page_read_bytes = page_read_bytes,
+					.page_zero_bytes = page_zero_bytes,
+					.writable = writable
+			};
+
+			memcpy(aux, &load_info, sizeof(struct load_info));
+			if (!vm_alloc_page_with_initializer (VM_ANON, upage,
+						writable, lazy_load_segment, aux))
+				return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
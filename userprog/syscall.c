@@ -77,10 +77,12 @@ static void
 close_handler(struct intr_frame* f);
 
 // project3
+#ifdef VM
 static void
 mmap_handler(struct intr_frame* f);
 static void
 munmap_handler(struct intr_frame* f);
+#endif
 
 
 #endif
@@ -132,9 +134,11 @@ syscall_init (void) {
 	syscall_handlers[SYS_SEEK] = seek_handler;
 	syscall_handlers[SYS_TELL] = tell_handler;
 	syscall_handlers[SYS_CLOSE] = close_handler;
+#ifdef VM
 	// project3 mmap 
 	syscall_handlers[SYS_MMAP] = mmap_handler;
-	//syscall_handlers[SYS_MUNMAP] = munmap_handler;
+	syscall_handlers[SYS_MUNMAP] = munmap_handler;
+#endif
 
 
 #endif /* syscall, project 2 */
@@ -405,11 +409,12 @@ close_handler(struct intr_frame* f)
 	file_close(file); 
 }
 
+#ifdef VM
 static void
 mmap_handler(struct intr_frame* f)  
 {
 	
-	void *addr = f->R.rdi;
+	void *addr = (void *) f->R.rdi;
 	size_t length = f->R.rsi;
 	int writable = f->R.rdx;
 	int fd = f->R.r10;
@@ -432,7 +437,8 @@ mmap_handler(struct intr_frame* f)
  
 	// file의 길이가 null or 0byte이면 return
 	if(file == NULL || file_length(file) == 0) {
-		thread_exit_by_error(-1);
+		f->R.rax = NULL;
+		return;
 	}
 
 	// addr가 0이거나 NULL이면 return
@@ -454,15 +460,17 @@ mmap_handler(struct intr_frame* f)
 	};
     
 
-	return do_mmap(addr, length, writable, file, offset);
+	f->R.rax = (uint64_t) do_mmap(addr, length, writable, file, offset);
 };
 
-// static void
-// munmap_handler(void *addr) 
-// {
+static void
+munmap_handler(struct intr_frame* f) 
+{
+	void *addr = (void *) f->R.rdi;
 
-// 	return do_munmap(addr);
-// };
+	do_munmap(addr);
+};
+#endif
 
 /***********************************************************/
 /* static functions */
@@ -497,11 +505,15 @@ is_write_valid(void* vaddr)
 
 void 
 check_valid_buffer(void *buffer, unsigned size, bool writable, struct intr_frame *f) {
-    void *addr = buffer;
+    void *page_addr;
+
+    if (size == 0)
+        return;
 
-    // 버퍼의 시작부터 크기만큼 반복하면서 모든 주소를 확인
-    for (unsigned i = 0; i < size; i += PGSIZE) {
-        void *page_addr = pg_round_down(addr + i); // 페이지 단위로 내림해서 확인
+    // 버퍼가 걸친 모든 페이지를 확인 (버퍼 끝이 걸친 마지막 페이지까지)
+    for (page_addr = pg_round_down(buffer);
+            page_addr <= pg_round_down(buffer + size - 1);
+            page_addr += PGSIZE) {
 
         // is_vaddr_valid()로 유효성 검사
         if (!is_vaddr_valid(page_addr)) {
@@ -513,11 +525,18 @@ check_valid_buffer(void *buffer, unsigned size, bool writable, struct intr_frame
         } else if (writable) {
             // 쓰기 권한이 있는지 확인
             struct page *page = spt_find_page(&thread_current()->spt, page_addr);
-            if (!page->writable) {
+            if (page == NULL || !page->writable) {
                 // 쓰기 권한이 없는 경우
                 thread_current()->exit_code = -1;
                 thread_exit();
             }
+            // fork 후 부모와 공유중인 프레임이면 커널이 쓰기 전에 복사해 둔다.
+            // 커널은 파일 시스템 lock 등을 잡은 채로 버퍼에 쓰므로, 그 안에서
+            // copy-on-write fault가 나지 않게 미리 공유를 푼다.
+            if (!vm_try_handle_fault(f, page_addr, false, true, false)) {
+                thread_current()->exit_code = -1;
+                thread_exit();
+            }
         }
     }
 }
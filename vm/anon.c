@@ -2,6 +2,12 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <bitmap.h>
+#include "threads/vaddr.h"
+#include "threads/malloc.h"
+
+/* project3: 페이지 하나를 담는 swap slot의 섹터 수 */
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,37 +23,144 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* project3: swap table, slot 하나당 비트 하나 (true = 사용중) */
+static struct bitmap *swap_table;
+/* slot마다 그 slot을 가리키는 페이지 수. fork 때 쫓겨나 있던 anon 페이지는
+ * 부모와 자식이 같은 slot을 가리키므로, 마지막 페이지가 놓을 때 slot을 반납한다. */
+static unsigned *swap_ref_cnt;
+static struct lock swap_lock;
+static size_t swap_hint; // 다음 slot 탐색 시작 위치 (next-fit)
+
+static size_t swap_slot_alloc (void);
+static void swap_slot_free (size_t slot);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	swap_hint = 0;
+
+	// swap 디스크가 없으면 anonymous page는 메모리에만 존재
+	if (swap_disk == NULL) {
+		swap_table = NULL;
+		return;
+	}
+	swap_table = bitmap_create (disk_size (swap_disk) / SECTORS_PER_PAGE);
+	if (swap_table == NULL)
+		PANIC ("swap table creation failed");
+	swap_ref_cnt = calloc (bitmap_size (swap_table), sizeof *swap_ref_cnt);
+	if (swap_ref_cnt == NULL)
+		PANIC ("swap table creation failed");
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->swap_slot = BITMAP_ERROR; // 아직 swap 디스크에 없음
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot = anon_page->swap_slot;
+
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	// 페이지 전체(SECTORS_PER_PAGE 섹터)를 한 번의 디스크 명령으로 읽는다
+	disk_read_multi (swap_disk, slot * SECTORS_PER_PAGE, SECTORS_PER_PAGE, kva);
+
+	// 같은 slot을 가리키는 다른 페이지가 남아 있으면 slot은 그대로 둔다
+	swap_slot_free (slot);
+	anon_page->swap_slot = BITMAP_ERROR;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot = swap_slot_alloc ();
+
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	// 페이지 전체를 한 번의 디스크 명령으로 쓴다
+	disk_write_multi (swap_disk, slot * SECTORS_PER_PAGE, SECTORS_PER_PAGE,
+			page->frame->kva);
+
+	anon_page->swap_slot = slot;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	// 쫓겨난 상태면 frame은 없고 swap slot만 반납
+	vm_free_frame (page);
+	if (anon_page->swap_slot != BITMAP_ERROR) {
+		swap_slot_free (anon_page->swap_slot);
+		anon_page->swap_slot = BITMAP_ERROR;
+	}
+}
+
+/* fork로 복사된 PAGE가 원본과 같은 swap slot을 가리키게 됐음을 기록한다.
+ * 자식은 처음 접근할 때 이 slot에서 읽어오므로, fork 때 부모 페이지를
+ * 다시 올릴 필요가 없다. */
+void
+anon_swap_dup (struct page *page) {
+	size_t slot = page->anon.swap_slot;
+
+	ASSERT (slot != BITMAP_ERROR);
+
+	lock_acquire (&swap_lock);
+	ASSERT (swap_ref_cnt[slot] > 0);
+	swap_ref_cnt[slot]++;
+	lock_release (&swap_lock);
+}
+
+/* Allocates a free swap slot and returns its index, or BITMAP_ERROR if
+ * the swap disk is full or missing.
+ * 마지막으로 할당한 slot 다음부터 찾는 next-fit 방식이라, 연속으로 쫓겨나는
+ * 페이지들은 디스크에 순차적으로 쓰인다. */
+static size_t
+swap_slot_alloc (void) {
+	size_t slot;
+
+	if (swap_table == NULL)
+		return BITMAP_ERROR;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_table, swap_hint, 1, false);
+	if (slot == BITMAP_ERROR && swap_hint != 0)
+		slot = bitmap_scan_and_flip (swap_table, 0, 1, false);
+	if (slot != BITMAP_ERROR) {
+		swap_ref_cnt[slot] = 1;
+		swap_hint = slot + 1;
+	}
+	lock_release (&swap_lock);
+
+	return slot;
+}
+
+/* Drops one reference to SLOT, returning it to the swap table when
+ * no page refers to it any more. */
+static void
+swap_slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_table, slot));
+	ASSERT (swap_ref_cnt[slot] > 0);
+	if (--swap_ref_cnt[slot] == 0)
+		bitmap_reset (swap_table, slot);
+	lock_release (&swap_lock);
 }
- 
\ No newline at end of file
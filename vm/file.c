@@ -2,10 +2,15 @@
 
 #include "vm/vm.h"
 #include "threads/vaddr.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "lib/string.h"
+#include <round.h>
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
+static bool file_backed_write_back (struct page *page);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -15,16 +20,6 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
-// 링커 오류 해결을 위한 load_info구조체 file.c안에 선언
-struct load_info_mmap
-{
-	struct file *file; // 파일 포인터
-	off_t offset;	   // 파일 오프셋
-	size_t page_read_bytes; // 파일에서 읽을 바이트 수
-	size_t page_zero_bytes; // 0으로 채울 바이트 수
-	bool writable;	   // 페이지가 쓰기 가능한지 여부
-};
-
 /* The initializer of file vm */
 void
 vm_file_init (void) {
@@ -32,79 +27,119 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED, void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
+	// 내용은 lazy_load_segment_mmap에서 aux로 채움
 	struct file_page *file_page = &page->file;
+	memset (file_page, 0, sizeof *file_page);
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset) != (int) file_page->read_bytes)
+		return false;
+	memset (kva + file_page->read_bytes, 0, file_page->zero_bytes);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	// 수정되지 않은 페이지는 파일에 그대로 있으므로 디스크 I/O 없이 프레임만 내려놓는다
+	return file_backed_write_back (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	// 프레임에 올라와 있는 동안 수정됐으면 파일에 반영한 뒤 해제
+	vm_wait_evicted (page);
+	if (page->frame != NULL)
+		file_backed_write_back (page);
+	vm_free_frame (page);
+	file_close (file_page->file);
+	file_page->file = NULL;
 }
 
+/* PAGE가 dirty면 파일에 다시 쓰고 dirty bit를 지운다. */
 static bool
-lazy_load_segment_mmap (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-	struct load_info *info = (struct load_info*)aux; 
-
-	// file 오프셋 설정
-	file_seek(info->file, info->offset);
+file_backed_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
 
-	// 피일에서 페이지 데이터 로드
-	if(file_read(info->file, page->frame->kva, info->page_read_bytes) != (int) info->page_read_bytes) {
-		palloc_free_page(page->frame->kva); // 실패시 페이지 메모리 해제
+	if (pml4 == NULL || !pml4_is_dirty (pml4, page->va))
+		return true;
+	if (file_write_at (file_page->file, page->frame->kva, file_page->read_bytes,
+				file_page->offset) != (int) file_page->read_bytes)
 		return false;
-	}
-	memset(page->frame->kva + info->page_read_bytes, 0, info->page_zero_bytes);
-	
+	pml4_set_dirty (pml4, page->va, false);
 	return true;
 }
 
+/* 첫 page fault 때 aux의 매핑 정보를 페이지로 옮기고 파일에서 읽어온다. */
+static bool
+lazy_load_segment_mmap (struct page *page, void *aux) {
+	struct file_page *info = aux;
+
+	page->file = *info;
+	free (info);
+
+	return file_backed_swap_in (page, page->frame->kva); // 실패시 프레임은 vm_do_claim_page에서 해제
+}
+
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
-	// lazy loading 구현 필요
-	size_t read_bytes = length; // 매핑할 데이터의 크기 
-	size_t zero_bytes = PGSIZE- (length % PGSIZE); // 남은데이터를 0으로 채울 크기
-	uint8_t first_addr = addr;
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *first_addr = addr;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	off_t file_len = file_length (file);
+
+	// 매핑할 범위 전체가 유저 영역이고 기존 페이지와 겹치지 않아야 함
+	if (length == 0 || (uint64_t) addr + page_cnt * PGSIZE < (uint64_t) addr)
+		return NULL;
+	for (size_t i = 0; i < page_cnt; i++) {
+		void *va = addr + i * PGSIZE;
+		if (!is_user_vaddr (va) || spt_find_page (spt, va) != NULL)
+			return NULL;
+	}
 
-	while(read_bytes > 0 || zero_bytes > 0) {
+	// 파일 끝을 넘는 부분은 0으로 채움
+	size_t read_bytes = offset < file_len ? file_len - offset : 0;
+	if (read_bytes > length)
+		read_bytes = length;
+	size_t zero_bytes = page_cnt * PGSIZE - read_bytes;
+
+	while (read_bytes > 0 || zero_bytes > 0) {
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		struct load_info_mmap *aux = malloc(sizeof(struct load_info_mmap));
-		struct load_info_mmap load_info_mmap = {
-			.file = file,
-			.offset = offset,
-			.page_read_bytes = page_read_bytes,
-			.page_zero_bytes = PGSIZE - page_read_bytes
-		};
-
-		memcpy(aux, &load_info_mmap, sizeof(struct load_info_mmap));
-
-		if(!vm_alloc_page_with_initializer(VM_ANON, addr,
+		// 페이지마다 파일을 reopen해서 munmap, 종료 순서와 상관없이 각자 닫을 수 있게 함
+		struct file_page *aux = malloc (sizeof (struct file_page));
+		if (aux == NULL)
+			goto err;
+		aux->file = file_reopen (file);
+		aux->offset = offset;
+		aux->read_bytes = page_read_bytes;
+		aux->zero_bytes = page_zero_bytes;
+		aux->mmap_addr = first_addr;
+
+		if (aux->file == NULL || !vm_alloc_page_with_initializer (VM_FILE, addr,
 					writable, lazy_load_segment_mmap, aux)) {
-			return NULL;
+			file_close (aux->file);
+			free (aux);
+			goto err;
 		}
-			
 
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
@@ -112,9 +147,67 @@ do_mmap (void *addr, size_t length, int writable,
 		offset += page_read_bytes;
 	}
 	return first_addr;
+
+err:
+	do_munmap (first_addr);
+	return NULL;
+}
+
+/* 실행 파일의 읽기 전용 세그먼트 페이지를 UPAGE에 등록.
+ * uninit 단계 없이 프레임이 없는 file 페이지로 바로 만들어서, 첫 fault 때
+ * vm_do_claim_page가 같은 (inode, offset)을 올려둔 프레임을 찾아 공유할 수 있게 한다. */
+bool
+file_backed_alloc_text (void *upage, struct file *file, off_t ofs,
+		size_t read_bytes) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	ASSERT (read_bytes <= PGSIZE);
+
+	if (spt_find_page (spt, upage) != NULL)
+		return false;
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return false;
+
+	page->operations = &file_ops;
+	page->va = upage;
+	page->frame = NULL;
+	page->writable = false;
+	page->owner = thread_current ();
+	page->file.file = file_reopen (file);
+	page->file.offset = ofs;
+	page->file.read_bytes = read_bytes;
+	page->file.zero_bytes = PGSIZE - read_bytes;
+	page->file.mmap_addr = NULL;
+
+	if (page->file.file == NULL || !spt_insert_page (spt, page)) {
+		file_close (page->file.file);
+		free (page);
+		return false;
+	}
+	return true;
+}
+
+/* PAGE가 속한 mmap 정보. 아직 접근되지 않은 페이지는 aux에 들어 있다. */
+static struct file_page *
+mmap_info (struct page *page) {
+	if (page->operations->type == VM_UNINIT)
+		return page->uninit.aux;
+	return &page->file;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, addr);
+
+	// addr에서 시작한 mmap의 페이지를 차례로 제거, dirty 페이지는 destroy에서 write back
+	while (page != NULL && page_get_type (page) == VM_FILE
+			&& mmap_info (page)->mmap_addr == addr) {
+		void *next = page->va + PGSIZE;
+		spt_remove_page (spt, page);
+		page = spt_find_page (spt, next);
+	}
 }
@@ -10,6 +10,7 @@
 
 #include "vm/vm.h"
 #include "vm/uninit.h"
+#include "threads/malloc.h"
 
 static bool uninit_initialize (struct page *page, void *kva);
 static void uninit_destroy (struct page *page);
@@ -62,7 +63,10 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	// 한 번도 접근되지 않은 페이지의 aux 정리, mmap 페이지는 reopen한 파일도 닫는다
+	if (uninit->aux != NULL && VM_TYPE (uninit->type) == VM_FILE)
+		file_close (((struct file_page *) uninit->aux)->file);
+	free (uninit->aux);
 }
@@ -7,6 +7,7 @@
 #include "threads/mmu.h"
 #include "threads/synch.h"
 #include "lib/string.h"
+#include "lib/stdio.h"
 #include "include/userprog/process.h"
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
@@ -16,6 +17,22 @@
 unsigned page_hash (const struct hash_elem *p_, void *aux UNUSED);
 bool page_less (const struct hash_elem *a_,const struct hash_elem *b_, void *aux UNUSED);
 void page_destructor (struct hash_elem *p_, void *aux UNUSED);
+unsigned frame_hash (const struct hash_elem *f_, void *aux UNUSED);
+bool frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
+
+/* project3: 전역 frame table */
+static struct frame_table frame_table;
+
+static void frame_table_insert (struct frame *frame);
+static void frame_table_link (struct frame *frame);
+static void frame_table_remove (struct frame *frame);
+static void frame_attach_page (struct frame *frame, struct page *page);
+static void frame_detach_page (struct frame *frame, struct page *page);
+static bool is_text_page (struct page *page);
+static bool vm_share_text_frame (struct page *page);
+static void frame_text_publish (struct frame *frame, struct page *page);
+static unsigned text_hash (const struct hash_elem *f_, void *aux UNUSED);
+static bool text_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
 
 void
 vm_init (void) {
@@ -27,6 +44,21 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
+	hash_init(&frame_table.frames, frame_hash, frame_less, NULL);
+	list_init(&frame_table.clock_list);
+	lock_init(&frame_table.hash_lock);
+	cond_init(&frame_table.evict_done);
+	frame_table.clock_hand = NULL;
+	hash_init(&frame_table.text_frames, text_hash, text_less, NULL);
+}
+
+/* Prints frame eviction statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frame: %lld evictions, %lld clock hand steps (max %zu per eviction)\n",
+			frame_table.evict_cnt, frame_table.sweep_cnt, frame_table.max_sweep);
+	printf ("Text: %lld faults served from shared frames\n",
+			frame_table.text_share_cnt);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -88,6 +120,7 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 		// 필드 수정
 		page->writable = writable;
+		page->owner = thread_current();
 
 		/* TODO: Insert the page into the spt. */
 		// 해당 페이지를 spt에 추가
@@ -141,49 +174,324 @@ spt_insert_page (struct supplemental_page_table *spt,
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	// spt에서 먼저 빼고 페이지 정리
+	lock_acquire(&spt->hash_lock);
+	hash_delete(&spt->pages, &page->hash_elem);
+	lock_release(&spt->hash_lock);
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* FRAME에 매핑된 페이지 중 하나라도 accessed bit가 켜져 있으면 true.
+ * 검사하면서 모든 페이지의 accessed bit를 끈다. */
+static bool
+frame_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Get the struct frame, that will be evicted.
+ * clock(second-chance) 알고리즘: hand가 가리키는 프레임부터 돌면서
+ * accessed bit가 켜져 있으면 끄고 넘어가고, 꺼져 있는 첫 프레임을 고른다.
+ * 공유중인 프레임은 공유하는 페이지 모두의 accessed bit를 본다.
+ * frame_table.hash_lock을 잡은 상태에서 호출해야 한다. */
 static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
 	 /* TODO: The policy for eviction is up to you. */
+	struct list_elem *e = frame_table.clock_hand;
+	size_t sweep = 0;
+	size_t limit = 2 * list_size (&frame_table.clock_list);
+
+	ASSERT (lock_held_by_current_thread (&frame_table.hash_lock));
+
+	if (list_empty (&frame_table.clock_list))
+		return NULL;
+
+	// 한 바퀴 돌면 모든 accessed bit가 꺼지므로 두 바퀴 안에 victim이 나옴
+	while (victim == NULL && sweep < limit) {
+		if (e == NULL || e == list_end (&frame_table.clock_list))
+			e = list_begin (&frame_table.clock_list);
+
+		struct frame *frame = list_entry (e, struct frame, clock_elem);
+		sweep++;
+
+		if (!frame_clear_accessed (frame)) // 켜져 있었으면 second chance
+			victim = frame;
+		e = list_next (e);
+	}
+	frame_table.clock_hand = e;
+
+	if (victim != NULL)
+		frame_table.evict_cnt++;
+	frame_table.sweep_cnt += sweep;
+	if (sweep > frame_table.max_sweep)
+		frame_table.max_sweep = sweep;
 
 	return victim;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ * swap out I/O 동안에는 hash_lock을 놓아서, 다른 스레드의 fault나 파일 I/O가
+ * 이 디스크 쓰기를 기다리지 않게 한다. 그동안 victim은 frame table에서 빠진 채
+ * evicting으로 표시되고, 이 페이지를 건드리려는 쪽은 vm_wait_evicted()로 기다린다.
+ * 공유중인 프레임은 공유하는 페이지를 하나씩 내보내므로, COW로 공유하던 anon
+ * 페이지는 각자 swap slot을 갖게 된다. 일부만 실패하면 실패한 페이지들만
+ * 다시 매핑하고 프레임은 그대로 둔다. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
+	struct frame *victim;
+	struct list_elem *e;
+	struct inode *text_inode;
+	bool success;
 	/* TODO: swap out the victim and return the evicted frame. */
 
-	return NULL;
+	lock_acquire (&frame_table.hash_lock);
+	victim = vm_get_victim ();
+	if (victim == NULL) {
+		lock_release (&frame_table.hash_lock);
+		return NULL;
+	}
+
+	// swap out 중에 페이지에 쓰지 못하도록 공유자 모두의 매핑부터 끊는다 (dirty bit는 유지됨)
+	for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page (page->owner->pml4, page->va);
+	}
+	// text 공유 테이블에서도 빠지므로, 실패하면 다시 등록할 수 있게 기억해둔다
+	text_inode = victim->text_inode;
+	frame_table_remove (victim);
+	victim->evicting = true;
+	lock_release (&frame_table.hash_lock);
+
+	// evicting 동안에는 다른 스레드가 pages 리스트를 바꾸지 않는다
+	e = list_begin (&victim->pages);
+	while (e != list_end (&victim->pages)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		bool ok = swap_out (page);
+
+		lock_acquire (&frame_table.hash_lock);
+		e = list_next (e);
+		if (ok)
+			frame_detach_page (victim, page);
+		lock_release (&frame_table.hash_lock);
+	}
+
+	lock_acquire (&frame_table.hash_lock);
+	victim->evicting = false;
+	success = victim->ref_cnt == 0;
+	if (!success) {
+		// 혼자 남았으면 COW가 끝난 것이므로 쓰기 권한도 돌려준다
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			pml4_set_page (page->owner->pml4, page->va, victim->kva,
+					page->writable && victim->ref_cnt == 1);
+		}
+		frame_table_link (victim);
+		// 그사이 다른 프로세스가 같은 text를 등록했으면 그쪽을 그대로 둔다
+		victim->text_inode = text_inode;
+		if (text_inode != NULL
+				&& hash_insert (&frame_table.text_frames, &victim->text_elem) != NULL)
+			victim->text_inode = NULL;
+	}
+	cond_broadcast (&frame_table.evict_done, &frame_table.hash_lock);
+	lock_release (&frame_table.hash_lock);
+
+	return success ? victim : NULL;
+}
+
+/* PAGE의 프레임이 swap out 중이면 끝날 때까지 기다린다.
+ * 돌아온 뒤 page->frame은 NULL(쫓겨남)이거나 다시 매핑된 프레임이다. */
+void
+vm_wait_evicted (struct page *page) {
+	lock_acquire (&frame_table.hash_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&frame_table.evict_done, &frame_table.hash_lock);
+	lock_release (&frame_table.hash_lock);
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * swap 디스크가 가득 차서 어떤 프레임도 내보내지 못하면 NULL을 반환한다. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = calloc(1, sizeof(struct frame));
+	struct frame *frame = NULL;
 	/* TODO: Fill this function. */
 	void *kva = palloc_get_page(PAL_USER | PAL_ZERO);
 	if(kva == NULL) {
-		PANIC("todo");
+		// user pool이 가득 찬 경우 페이지 하나를 쫓아내고 그 프레임을 재사용
+		// swap out에 실패하면 clock hand가 넘어갔으므로 다른 프레임으로 다시 시도
+		size_t tries;
+
+		lock_acquire(&frame_table.hash_lock);
+		tries = hash_size(&frame_table.frames);
+		lock_release(&frame_table.hash_lock);
+		while ((frame = vm_evict_frame()) == NULL)
+			if (tries-- == 0)
+				return NULL;
+		memset(frame->kva, 0, PGSIZE);
+	} else {
+		frame = calloc(1, sizeof(struct frame));
+		ASSERT (frame != NULL);
+		frame->kva = kva;
+		list_init(&frame->pages);
 	}
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 
-	frame->kva = kva;
 	return frame;
 }
 
+/* Releases the frame that PAGE is holding, if any.
+ * Called by the destroy handler of each page type.
+ * 다른 프로세스와 공유중인 프레임이면 매핑만 끊고 프레임은 남겨둔다. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_table.hash_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&frame_table.evict_done, &frame_table.hash_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		if (page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+		frame_detach_page (frame, page);
+		if (frame->ref_cnt == 0) {
+			frame_table_remove (frame);
+			palloc_free_page (frame->kva);
+			free (frame);
+		}
+	}
+	lock_release (&frame_table.hash_lock);
+}
+
+/* PAGE를 FRAME에 연결. COW 공유시 여러 페이지가 한 프레임을 가리킨다. */
+static void
+frame_attach_page (struct frame *frame, struct page *page) {
+	if (frame->page == NULL)
+		frame->page = page;
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	page->frame = frame;
+}
+
+/* PAGE를 FRAME에서 떼어냄. 대표 페이지였다면 남은 페이지 중 하나로 교체. */
+static void
+frame_detach_page (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == frame);
+
+	list_remove (&page->frame_elem);
+	frame->ref_cnt--;
+	page->frame = NULL;
+	if (frame->page == page)
+		frame->page = list_empty (&frame->pages) ? NULL
+			: list_entry (list_front (&frame->pages), struct page, frame_elem);
+}
+
+/* 프레임을 frame table에 등록. clock hand 바로 뒤에 넣어서
+ * 새로 들어온 프레임이 가장 늦게 검사되도록 한다. */
+static void
+frame_table_insert (struct frame *frame) {
+	lock_acquire (&frame_table.hash_lock);
+	frame_table_link (frame);
+	lock_release (&frame_table.hash_lock);
+}
+
+/* frame_table_insert()와 같지만 hash_lock을 잡은 상태에서 호출. */
+static void
+frame_table_link (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_table.hash_lock));
+
+	hash_insert (&frame_table.frames, &frame->hash_elem);
+	if (frame_table.clock_hand != NULL
+			&& frame_table.clock_hand != list_end (&frame_table.clock_list))
+		list_insert (frame_table.clock_hand, &frame->clock_elem);
+	else
+		list_push_back (&frame_table.clock_list, &frame->clock_elem);
+}
+
+/* 프레임을 frame table에서 제거. hash_lock을 잡은 상태에서 호출. */
+static void
+frame_table_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_table.hash_lock));
+
+	if (frame_table.clock_hand == &frame->clock_elem)
+		frame_table.clock_hand = list_next (&frame->clock_elem);
+	list_remove (&frame->clock_elem);
+	hash_delete (&frame_table.frames, &frame->hash_elem);
+	if (frame->text_inode != NULL) {
+		hash_delete (&frame_table.text_frames, &frame->text_elem);
+		frame->text_inode = NULL;
+	}
+}
+
+/* 읽기 전용 실행 파일 페이지인지. mmap 페이지는 write()로 파일이 바뀔 수 있어 제외. */
+static bool
+is_text_page (struct page *page) {
+	return !page->writable && VM_TYPE (page->operations->type) == VM_FILE
+		&& page->file.mmap_addr == NULL;
+}
+
+/* 같은 (inode, offset)을 다른 프로세스가 이미 올려뒀으면 그 프레임을 읽기 전용으로
+ * 매핑한다. 디스크 I/O 없이 fault가 끝나면 true. */
+static bool
+vm_share_text_frame (struct page *page) {
+	struct frame key;
+	struct hash_elem *e;
+	struct frame *frame;
+	bool success = false;
+
+	key.text_inode = file_get_inode (page->file.file);
+	key.text_ofs = page->file.offset;
+
+	lock_acquire (&frame_table.hash_lock);
+	e = hash_find (&frame_table.text_frames, &key.text_elem);
+	if (e != NULL) {
+		frame = hash_entry (e, struct frame, text_elem);
+		if (frame->text_read_bytes == page->file.read_bytes) {
+			frame_attach_page (frame, page);
+			success = pml4_set_page (page->owner->pml4, page->va, frame->kva, false);
+			if (success)
+				frame_table.text_share_cnt++;
+			else
+				frame_detach_page (frame, page);
+		}
+	}
+	lock_release (&frame_table.hash_lock);
+	return success;
+}
+
+/* 방금 파일에서 읽어온 text 프레임을 공유 테이블에 등록.
+ * 다른 프로세스가 먼저 등록했으면 그쪽을 그대로 둔다. */
+static void
+frame_text_publish (struct frame *frame, struct page *page) {
+	lock_acquire (&frame_table.hash_lock);
+	frame->text_inode = file_get_inode (page->file.file);
+	frame->text_ofs = page->file.offset;
+	frame->text_read_bytes = page->file.read_bytes;
+	if (hash_insert (&frame_table.text_frames, &frame->text_elem) != NULL)
+		frame->text_inode = NULL;
+	lock_release (&frame_table.hash_lock);
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr) {
@@ -192,8 +500,52 @@ vm_stack_growth (void *addr) {
 }
 
 /* Handle the fault on write_protected page */
+/* copy-on-write: 공유중인 프레임에 쓰려고 하면 새 프레임에 복사해서 가져가고,
+ * 혼자 남은 프레임이면 쓰기 권한만 다시 켜준다. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old, *new;
+	uint64_t *pml4 = page->owner->pml4;
+
+	lock_acquire (&frame_table.hash_lock);
+	old = page->frame;
+	// 쫓겨나는 중이면 매핑이 이미 끊겨 있으므로 쫓겨난 것과 같이 취급
+	if (old != NULL && old->evicting)
+		old = NULL;
+	if (old != NULL && old->ref_cnt == 1)
+		pml4_set_page (pml4, page->va, old->kva, true);
+	lock_release (&frame_table.hash_lock);
+
+	// 그사이 쫓겨났다면 다시 fault가 나서 swap in 된다
+	if (old == NULL || old->ref_cnt == 1)
+		return true;
+
+	// 새 프레임을 구하는 동안 eviction이 일어날 수 있으므로 lock 밖에서 구함
+	new = vm_get_frame ();
+	if (new == NULL)
+		return false;
+
+	lock_acquire (&frame_table.hash_lock);
+	old = page->frame;
+	if (old != NULL && old->evicting)
+		old = NULL;
+	if (old == NULL || old->ref_cnt == 1) {
+		// 기다리는 동안 다른 공유자가 사라진 경우
+		if (old != NULL)
+			pml4_set_page (pml4, page->va, old->kva, true);
+		lock_release (&frame_table.hash_lock);
+		palloc_free_page (new->kva);
+		free (new);
+		return true;
+	}
+	memcpy (new->kva, old->kva, PGSIZE);
+	frame_detach_page (old, page);
+	frame_attach_page (new, page);
+	pml4_set_page (pml4, page->va, new->kva, true);
+	lock_release (&frame_table.hash_lock);
+
+	frame_table_insert (new);
+	return true;
 }
 
 /* Return true on success */
@@ -241,6 +593,12 @@ vm_try_handle_fault (struct intr_frame *f, void *addr,
 	
 		return vm_do_claim_page (page);
 	}
+
+	// 읽기 전용으로 공유중인 페이지에 쓰기 → copy-on-write
+	page = spt_find_page(spt, addr);
+	if (write && page != NULL && page->writable)
+		return vm_handle_wp (page);
+
 	return false;
 }
 
@@ -268,19 +626,44 @@ vm_claim_page (void *va) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
+	// swap out이 끝나기 전에 swap in 하면 아직 쓰이지 않은 slot을 읽게 된다
+	vm_wait_evicted (page);
+	if (page->frame != NULL)
+		return true; // swap out이 실패해서 다시 매핑됨
+
+	// 읽기 전용 text 페이지는 다른 프로세스가 올려둔 프레임이 있으면 그대로 공유
+	if (is_text_page (page) && vm_share_text_frame (page))
+		return true;
+
 	struct frame *frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_attach_page(frame, page);
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-	if(!pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable)) {
-		palloc_free_page(frame->kva);
-		return false;
+	// fork 중에는 부모의 페이지를 자식 스레드가 claim할 수 있으므로 owner의 pml4 사용
+	if(!pml4_set_page(page->owner->pml4, page->va, frame->kva, page->writable)) {
+		goto err;
+	}
+
+	if (!swap_in (page, frame->kva)) {
+		pml4_clear_page(page->owner->pml4, page->va);
+		goto err;
 	}
 
-	return swap_in (page, frame->kva);
+	// 내용이 다 채워진 뒤에 등록해야 swap in 도중에 쫓겨나지 않음
+	if (is_text_page (page))
+		frame_text_publish (frame, page);
+	frame_table_insert(frame);
+	return true;
+
+err:
+	frame_detach_page(frame, page);
+	palloc_free_page(frame->kva);
+	free(frame);
+	return false;
 }
 
 /* Initialize new supplemental page table */
@@ -313,8 +696,22 @@ supplemental_page_table_copy (struct supplemental_page_table *dst,
 
 		// uninit은 alloc까지만 해두고 pagefault가 발생할때 claim되도록
 		if(type == VM_UNINIT) {
-			struct load_info *copied_aux = malloc(sizeof(struct load_info)); // load_info 넘겨주기
-			memcpy(copied_aux, origin_page->uninit.aux, sizeof(struct load_info)); // aux를 memcpy해서 free되는 것을 방지
+			void *copied_aux;
+			if(VM_TYPE(origin_page->uninit.type) == VM_FILE) {
+				// mmap 페이지는 file_page를 aux로 쓰고, 파일은 자식 몫으로 따로 reopen
+				struct file_page *origin_aux = origin_page->uninit.aux;
+				struct file_page *file_aux = malloc(sizeof(struct file_page));
+				if(file_aux == NULL)
+					return false;
+				memcpy(file_aux, origin_aux, sizeof(struct file_page));
+				file_aux->file = file_reopen(origin_aux->file);
+				copied_aux = file_aux;
+			} else {
+				copied_aux = malloc(sizeof(struct load_info)); // load_info 넘겨주기
+				if(copied_aux == NULL)
+					return false;
+				memcpy(copied_aux, origin_page->uninit.aux, sizeof(struct load_info)); // aux를 memcpy해서 free되는 것을 방지
+			}
 			if (!vm_alloc_page_with_initializer (origin_page->uninit.type, origin_page->va,
 					origin_page->writable, origin_page->uninit.init, copied_aux))
 				return false;
@@ -322,20 +719,50 @@ supplemental_page_table_copy (struct supplemental_page_table *dst,
 			continue;
 		}
 
-		// anon, file은 claim까지 진행
-		if(!(vm_alloc_page(type, origin_page->va, origin_page->writable) &&
-							vm_claim_page(origin_page->va))) {
+		// anon, file은 부모의 프레임을 읽기 전용으로 공유 (copy-on-write)
+		struct page *copied_page = malloc(sizeof(struct page));
+		if(copied_page == NULL) {
 			return false;
 		}
 
-		// copeid page에 origin page memcpy
-		struct page *copied_page = spt_find_page(dst, origin_page->va);
-		if(copied_page == NULL) {
-			return false;
+		// swap out 중이면 끝날 때까지 기다린다. 끝난 뒤 frame이 NULL이면 쫓겨난 상태
+		lock_acquire(&frame_table.hash_lock);
+		while(origin_page->frame != NULL && origin_page->frame->evicting)
+			cond_wait(&frame_table.evict_done, &frame_table.hash_lock);
+
+		struct frame *frame = origin_page->frame;
+		bool mapped = true;
+		memcpy(copied_page, origin_page, sizeof(struct page));
+		copied_page->owner = thread_current();
+		copied_page->frame = NULL;
+		if(frame != NULL) {
+			frame_attach_page(frame, copied_page);
+
+			// 부모, 자식 모두 쓰기 금지로 매핑해서 첫 쓰기 때 vm_handle_wp가 불리도록 함
+			// (dirty bit를 보존하기 위해 pml4_set_page 대신 W bit만 끈다)
+			uint64_t *pte = pml4e_walk(origin_page->owner->pml4, (uint64_t) origin_page->va, 0);
+			if(pte != NULL)
+				*pte &= ~PTE_W;
+			mapped = pml4_set_page(thread_current()->pml4, copied_page->va, frame->kva, false);
+		} else if(type == VM_ANON) {
+			// 쫓겨난 anon 페이지는 부모의 swap slot을 같이 가리키다가 자식이 접근할 때 읽는다
+			anon_swap_dup(copied_page);
 		}
+		// 쫓겨난 file 페이지는 매핑 없이 두면 자식이 접근할 때 파일에서 읽는다
+		lock_release(&frame_table.hash_lock);
+
+		// mmap 페이지는 자식이 쓸 파일을 따로 reopen
+		if(type == VM_FILE)
+			copied_page->file.file = file_reopen(origin_page->file.file);
 
-		// spt에 커널 물리 주소
-		memcpy(copied_page->frame->kva, origin_page->frame->kva, PGSIZE);
+		// 실패해도 destroy를 거쳐야 프레임, swap slot 공유가 풀린다
+		if(!spt_insert_page(dst, copied_page)) {
+			vm_dealloc_page(copied_page);
+			return false;
+		}
+		if(!mapped || (type == VM_FILE && copied_page->file.file == NULL)) {
+			return false;
+		}
 	}
 	return true;
 }
@@ -387,4 +814,21 @@ frame_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNU
 	const struct frame *a = hash_entry(a_, struct frame, hash_elem);
 	const struct frame *b = hash_entry(b_, struct frame, hash_elem);
 	return a->kva < b->kva;
-}
\ No newline at end of file
+}
+
+/* text 공유 테이블: (inode, offset)으로 프레임을 찾는다 */
+static unsigned
+text_hash (const struct hash_elem *f_, void *aux UNUSED) {
+	const struct frame *f = hash_entry (f_, struct frame, text_elem);
+	return hash_bytes (&f->text_inode, sizeof f->text_inode)
+		^ hash_int (f->text_ofs);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+	if (a->text_inode != b->text_inode)
+		return a->text_inode < b->text_inode;
+	return a->text_ofs < b->text_ofs;
+}